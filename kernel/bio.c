@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,17 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Buffers are hashed by (dev, blockno) into NBUCKET buckets, each
+// with its own lock, so lookups of different blocks rarely contend.
+// A cache hit takes only its bucket's lock. A miss recycles the
+// unused buffer with the oldest b->lastuse, under bcache.lock so
+// that only one process at a time moves buffers between buckets.
+//
+// breadahead() reads blocks into the cache without waiting for
+// them; the disk interrupt releases each buffer when its read is
+// done. Counters record how many of these blocks were later used
+// (hits) and how many were recycled unused (waste).
 
 #include "types.h"
 #include "param.h"
@@ -21,116 +32,332 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "kstat.h"
 
-struct {
+#define NBUCKET 13
+
+struct bucket {
   struct spinlock lock;
+  struct buf head;  // circular list of buffers, through prev/next
+};
+
+struct {
+  struct spinlock lock;  // serializes recycling on a cache miss
   struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  uint64 clock;  // counts releases, for b->lastuse; atomic
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  // read-ahead counters, updated atomically.
+  uint64 raissued;  // blocks read ahead
+  uint64 rahit;     // of those, later used
+  uint64 rawaste;   // of those, recycled unused
 } bcache;
 
+static struct bucket *bhash(uint dev, uint blockno) { return &bcache.bucket[(dev * 31 + blockno) % NBUCKET]; }
+
+// Insert b at the front of bucket bk's list. Caller holds bk->lock.
+static void binsert(struct bucket *bk, struct buf *b) {
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+// Unlink b from the bucket list it is on. Caller holds that bucket's lock.
+static void bremove(struct buf *b) {
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
 void binit(void) {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  for (bk = bcache.bucket; bk < bcache.bucket + NBUCKET; bk++) {
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+
+  // Spread the buffers over the buckets.
   for (b = bcache.buf; b < bcache.buf + NBUF; b++) {
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    binsert(&bcache.bucket[(b - bcache.buf) % NBUCKET], b);
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
-static struct buf *bget(uint dev, uint blockno) {
+// Look for block blockno on device dev in bucket bk.
+// If found, take a reference and return it.
+// Caller holds bk->lock.
+static struct buf *blookup(struct bucket *bk, uint dev, uint blockno) {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for (b = bcache.head.next; b != &bcache.head; b = b->next) {
+  for (b = bk->head.next; b != &bk->head; b = b->next) {
     if (b->dev == dev && b->blockno == blockno) {
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+// For read-ahead, return 0 instead if the block is already
+// cached or there is no free buffer: read-ahead only wants
+// blocks it can fetch without waiting, and must not panic.
+static struct buf *bget(uint dev, uint blockno, int ahead) {
+  struct bucket *bk = bhash(dev, blockno);
+  struct bucket *vbk, *bestbk;
+  struct buf *b, *best;
+
+  // Is the block already cached?
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if (b) goto found;
 
   // Not cached.
+  acquire(&bcache.lock);
+
+  // Someone else may have cached it while bk->lock was free.
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if (b) {
+    release(&bcache.lock);
+    goto found;
+  }
+
   // Recycle the least recently used (LRU) unused buffer.
-  for (b = bcache.head.prev; b != &bcache.head; b = b->prev) {
-    if (b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Keep the lock of the bucket holding the best candidate so far,
+  // so that nobody can take a reference to it behind our back.
+  best = 0;
+  bestbk = 0;
+  for (vbk = bcache.bucket; vbk < bcache.bucket + NBUCKET; vbk++) {
+    acquire(&vbk->lock);
+    int found = 0;
+    for (b = vbk->head.next; b != &vbk->head; b = b->next) {
+      if (b->refcnt == 0 && (best == 0 || b->lastuse < best->lastuse)) {
+        best = b;
+        found = 1;
+      }
+    }
+    if (found) {
+      if (bestbk) release(&bestbk->lock);
+      bestbk = vbk;
+    } else {
+      release(&vbk->lock);
     }
   }
-  panic("bget: no buffers");
+  if (best == 0) {
+    if (!ahead) panic("bget: no buffers");
+    release(&bcache.lock);
+    return 0;
+  }
+
+  b = best;
+  if (b->prefetched) {
+    // read ahead, but never used.
+    b->prefetched = 0;
+    __sync_fetch_and_add(&bcache.rawaste, 1);
+  }
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  if (bestbk != bk) {
+    bremove(b);
+    release(&bestbk->lock);
+    acquire(&bk->lock);
+    binsert(bk, b);
+  }
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
+
+found:
+  if (ahead) {
+    // already cached; drop the reference blookup() took.
+    acquire(&bk->lock);
+    b->refcnt--;
+    release(&bk->lock);
+    return 0;
+  }
+  acquiresleep(&b->lock);
+  if (b->prefetched) {
+    b->prefetched = 0;
+    __sync_fetch_and_add(&bcache.rahit, 1);
+  }
+  return b;
+}
+
+// Return a locked buf for the indicated block, starting a
+// disk read if it is not cached. Call bwait() before using
+// the data.
+struct buf *bread_async(uint dev, uint blockno) {
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  if (!b->valid) {
+    virtio_disk_submit(&b, 1, 0);
+    b->valid = 1;  // once the read finishes; until then b->disk is set
+  }
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
 struct buf *bread(uint dev, uint blockno) {
   struct buf *b;
 
-  b = bget(dev, blockno);
-  if (!b->valid) {
-    virtio_disk_rw(b, 0);
-    b->valid = 1;
+  b = bread_async(dev, blockno);
+  bwait(b);
+  return b;
+}
+
+// Return locked bufs for the n blocks starting at blockno
+// in bs[0..n-1], reading the ones not cached with as few
+// disk requests as possible. n is at most NBULK.
+void breadn(uint dev, uint blockno, int n, struct buf **bs) {
+  int i, j;
+
+  for (i = 0; i < n; i++) bs[i] = bget(dev, blockno + i, 0);
+  for (i = 0; i < n; i = j) {
+    if (bs[i]->valid) {
+      j = i + 1;
+      continue;
+    }
+    for (j = i + 1; j < n && !bs[j]->valid; j++);
+    virtio_disk_submit(bs + i, j - i, 0);
+    while (i < j) bs[i++]->valid = 1;
   }
+  for (i = 0; i < n; i++) bwait(bs[i]);
+}
+
+// Return a locked buf for block blockno without reading it
+// from disk, for a caller that will overwrite all of it.
+struct buf *bgetw(uint dev, uint blockno) {
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  b->valid = 1;
   return b;
 }
 
+// Start writing the n locked bufs in bs[], which hold
+// consecutive blocks, to disk with one request.
+// Call bwait() on each before changing its data.
+void bwrite_async(struct buf **bs, int n) {
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (!holdingsleep(&bs[i]->lock)) panic("bwrite_async");
+  }
+  virtio_disk_submit(bs, n, 1);
+}
+
+// Like bwrite_async(), but write the bufs to the n blocks
+// from blockno on instead of the blocks they cache. The log
+// uses this to install a copy of a block without touching
+// the cached block, which may have changed since.
+void bwrite_at(struct buf **bs, int n, uint blockno) {
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (!holdingsleep(&bs[i]->lock)) panic("bwrite_at");
+  }
+  virtio_disk_submit_at(bs, n, blockno, 1);
+}
+
 // Write b's contents to disk.  Must be locked.
 void bwrite(struct buf *b) {
-  if (!holdingsleep(&b->lock)) panic("bwrite");
-  virtio_disk_rw(b, 1);
+  bwrite_async(&b, 1);
+  bwait(b);
 }
 
-// Release a locked buffer.
-// Move to the head of the most-recently-used list.
-void brelse(struct buf *b) {
-  if (!holdingsleep(&b->lock)) panic("brelse");
+// Wait for the disk to finish with b, if it has a
+// read or write in flight.
+void bwait(struct buf *b) {
+  // only the disk interrupt clears b->disk, and only
+  // b's holder sets it, so a 0 here stays 0.
+  if (b->disk) virtio_disk_wait(b);
+}
+
+// Unlock b and drop a reference to it.
+// Stamp it with the order of last use, for LRU recycling.
+// Also the iodone callback of read-ahead buffers, so it may
+// run in the disk interrupt, for a process that is long gone.
+static void bput(struct buf *b) {
+  struct bucket *bk;
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = __sync_add_and_fetch(&bcache.clock, 1);
   }
+  release(&bk->lock);
+}
 
-  release(&bcache.lock);
+// Release a locked buffer.
+void brelse(struct buf *b) {
+  if (!holdingsleep(&b->lock)) panic("brelse");
+
+  bwait(b);
+  bput(b);
+}
+
+// Start reading the n blocks from blockno on into the cache,
+// skipping any already cached, and return without waiting.
+// Each buffer is released when its read finishes.
+void breadahead(uint dev, uint blockno, int n) {
+  struct buf *bs[NBULK], *b;
+  int i, m;
+
+  if (n > NBULK) n = NBULK;
+  m = 0;
+  for (i = 0; i <= n; i++) {
+    b = i < n ? bget(dev, blockno + i, 1) : 0;
+    if (b) {
+      b->prefetched = 1;
+      b->iodone = bput;
+      b->valid = 1;  // once the read finishes
+      bs[m++] = b;
+    } else if (m > 0) {
+      // bs[] holds a run of consecutive blocks.
+      virtio_disk_submit(bs, m, 0);
+      __sync_fetch_and_add(&bcache.raissued, m);
+      m = 0;
+    }
+  }
+}
+
+// Report the read-ahead counters.
+void rastat(struct rastat *st) {
+  st->issued = __atomic_load_n(&bcache.raissued, __ATOMIC_SEQ_CST);
+  st->hit = __atomic_load_n(&bcache.rahit, __ATOMIC_SEQ_CST);
+  st->waste = __atomic_load_n(&bcache.rawaste, __ATOMIC_SEQ_CST);
 }
 
 void bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
@@ -1,11 +1,14 @@
 struct buf {
   int valid;  // has data been read from disk?
   int disk;   // does disk "own" buf?
+  int prefetched;  // read ahead, and not used since?
+  void (*iodone)(struct buf *);  // if set, called when the disk is done with buf
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev;  // LRU cache list
+  uint64 lastuse;    // bcache.clock at last brelse(), for LRU recycling
+  struct buf *prev;  // hash bucket list
   struct buf *next;
   uchar data[BSIZE];
 };
@@ -2,6 +2,13 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmemstat;
+struct rastat;
+struct logstat;
+struct schedstat;
+struct schedlat;
+struct slabstat;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -12,8 +19,16 @@ struct superblock;
 // bio.c
 void binit(void);
 struct buf *bread(uint, uint);
+struct buf *bread_async(uint, uint);
+void breadn(uint, uint, int, struct buf **);
+struct buf *bgetw(uint, uint);
 void brelse(struct buf *);
 void bwrite(struct buf *);
+void bwrite_async(struct buf **, int);
+void bwrite_at(struct buf **, int, uint);
+void bwait(struct buf *);
+void breadahead(uint, uint, int);
+void rastat(struct rastat *);
 void bpin(struct buf *);
 void bunpin(struct buf *);
 
@@ -30,9 +45,10 @@ struct file *filealloc(void);
 void fileclose(struct file *);
 struct file *filedup(struct file *);
 void fileinit(void);
-int fileread(struct file *, uint64, int n);
+int fileread(struct file *, int, uint64, int n);
 int filestat(struct file *, uint64 addr);
-int filewrite(struct file *, uint64, int n);
+int filewrite(struct file *, int, uint64, int n);
+int filesplice(struct file *, struct file *, int);
 
 // fs.c
 void fsinit(int);
@@ -50,6 +66,7 @@ int namecmp(const char *, const char *);
 struct inode *namei(char *);
 struct inode *nameiparent(char *, char *);
 int readi(struct inode *, int, uint64, uint, uint);
+struct buf *ibread(struct inode *, uint, uint);
 void stati(struct inode *, struct stat *);
 int writei(struct inode *, int, uint64, uint, uint);
 void itrunc(struct inode *);
@@ -61,20 +78,49 @@ void ramdiskrw(struct buf *);
 
 // kalloc.c
 void *kalloc(void);
+void *kalloc_zeroed(void);
+int kzerofill(void);
+void *kalloc_pages(int);
+void kfree_pages(void *, int);
 void kfree(void *);
+void kaddref(void *);
+int krefcnt(void *);
 void kinit(void);
+void kmemstat(struct kmemstat *);
+
+// slab.c
+void slabinit(void);
+struct kmem_cache *kmem_cache_create(char *, uint, void (*)(void *));
+void *kmem_cache_alloc(struct kmem_cache *);
+void kmem_cache_free(struct kmem_cache *, void *);
+int slabshrink(void);
+void slabstat(struct slabstat *);
 
 // log.c
 void initlog(int, struct superblock *);
 void log_write(struct buf *);
+void logstat(struct logstat *);
+void log_sync(void);
 void begin_op(void);
 void end_op(void);
 
+// mmap.c
+uint64 mmap(uint64, uint64, int, int, struct file *, uint);
+int munmap(uint64, uint64);
+int vmafault(struct proc *, uint64, uint64);
+void vmaprefault(struct proc *, uint64, uint64, int);
+void vmafree(struct proc *);
+int vmacopy(struct proc *, struct proc *);
+uint64 vmalow(struct proc *);
+
 // pipe.c
+void pipeinit(void);
 int pipealloc(struct file **, struct file **);
 void pipeclose(struct pipe *, int);
-int piperead(struct pipe *, uint64, int);
-int pipewrite(struct pipe *, uint64, int);
+int piperead(struct pipe *, int, uint64, int);
+int pipewrite(struct pipe *, int, uint64, int);
+int piperoom(struct pipe *);
+int pipeput(struct pipe *, char *, int);
 
 // printf.c
 int printf(char *, ...) __attribute__((format(printf, 1, 2)));
@@ -100,9 +146,18 @@ void scheduler(void) __attribute__((noreturn));
 void sched(void);
 void sleep(void *, struct spinlock *);
 void userinit(void);
+void kthread(void (*)(void), char *);
 int wait(uint64);
 void wakeup(void *);
 void yield(void);
+void proctick(void);
+void prioboost(void);
+int setpriority(int, int);
+int getpriority(int);
+void schedstat(struct schedstat *);
+int setquantum(int, int);
+int getquantum(int);
+int schedlat(int, struct schedlat *);
 int either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void procdump(void);
@@ -124,6 +179,9 @@ void releasesleep(struct sleeplock *);
 int holdingsleep(struct sleeplock *);
 void initsleeplock(struct sleeplock *, char *);
 
+// membench.c
+void membench(void);
+
 // string.c
 int memcmp(const void *, const void *, uint);
 void *memmove(void *, const void *, uint);
@@ -141,6 +199,12 @@ int fetchstr(uint64, char *, int);
 int fetchaddr(uint64, uint64 *);
 void syscall();
 
+// timer.c
+void tminit(void);
+int sleepuntil(uint64);
+void tmexpire(void);
+void tmarm(void);
+
 // trap.c
 extern uint ticks;
 void trapinit(void);
@@ -165,6 +229,7 @@ void uvmfirst(pagetable_t, uchar *, uint);
 uint64 uvmalloc(pagetable_t, uint64, uint64, int);
 uint64 uvmdealloc(pagetable_t, uint64, uint64);
 int uvmcopy(pagetable_t, pagetable_t, uint64);
+int uvmshare(pagetable_t, pagetable_t, uint64, uint64, int);
 void uvmfree(pagetable_t, uint64);
 void uvmunmap(pagetable_t, uint64, uint64, int);
 void uvmclear(pagetable_t, uint64);
@@ -173,6 +238,8 @@ uint64 walkaddr(pagetable_t, uint64);
 int copyout(pagetable_t, uint64, char *, uint64);
 int copyin(pagetable_t, char *, uint64, uint64);
 int copyinstr(pagetable_t, char *, uint64, uint64);
+int cowfault(pagetable_t, uint64);
+int lazyalloc(pagetable_t, uint64, uint64, int);
 
 // plic.c
 void plicinit(void);
@@ -183,6 +250,9 @@ void plic_complete(int);
 // virtio_disk.c
 void virtio_disk_init(void);
 void virtio_disk_rw(struct buf *, int);
+void virtio_disk_submit(struct buf **, int, int);
+void virtio_disk_submit_at(struct buf **, int, uint, int);
+void virtio_disk_wait(struct buf *);
 void virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -9,6 +9,7 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "buf.h"
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
@@ -87,20 +88,21 @@ int filestat(struct file *f, uint64 addr) {
 }
 
 // Read from file f.
-// addr is a user virtual address.
-int fileread(struct file *f, uint64 addr, int n) {
+// If user_dst==1, then addr is a user virtual address;
+// otherwise, addr is a kernel address.
+int fileread(struct file *f, int user_dst, uint64 addr, int n) {
   int r = 0;
 
   if (f->readable == 0) return -1;
 
   if (f->type == FD_PIPE) {
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, user_dst, addr, n);
   } else if (f->type == FD_DEVICE) {
     if (f->major < 0 || f->major >= NDEV || !devsw[f->major].read) return -1;
-    r = devsw[f->major].read(1, addr, n);
+    r = devsw[f->major].read(user_dst, addr, n);
   } else if (f->type == FD_INODE) {
     ilock(f->ip);
-    if ((r = readi(f->ip, 1, addr, f->off, n)) > 0) f->off += r;
+    if ((r = readi(f->ip, user_dst, addr, f->off, n)) > 0) f->off += r;
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -110,25 +112,27 @@ int fileread(struct file *f, uint64 addr, int n) {
 }
 
 // Write to file f.
-// addr is a user virtual address.
-int filewrite(struct file *f, uint64 addr, int n) {
+// If user_src==1, then addr is a user virtual address;
+// otherwise, addr is a kernel address.
+int filewrite(struct file *f, int user_src, uint64 addr, int n) {
   int r, ret = 0;
 
   if (f->writable == 0) return -1;
 
   if (f->type == FD_PIPE) {
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, user_src, addr, n);
   } else if (f->type == FD_DEVICE) {
     if (f->major < 0 || f->major >= NDEV || !devsw[f->major].write) return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(user_src, addr, n);
   } else if (f->type == FD_INODE) {
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
+    // i-node, indirect block, the two levels of the
+    // doubly-indirect block, allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE;
+    int max = ((MAXOPBLOCKS - 1 - 1 - 2 - 2) / 2) * BSIZE;
     int i = 0;
     while (i < n) {
       int n1 = n - i;
@@ -136,7 +140,7 @@ int filewrite(struct file *f, uint64 addr, int n) {
 
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0) f->off += r;
+      if ((r = writei(f->ip, user_src, addr + i, f->off, n1)) > 0) f->off += r;
       iunlock(f->ip);
       end_op();
 
@@ -153,3 +157,63 @@ int filewrite(struct file *f, uint64 addr, int n) {
 
   return ret;
 }
+
+// Move up to n bytes from file in to pipe out straight from
+// the buffer cache. Each block is read only once the pipe
+// has room, so that the pipe's reader never waits for a
+// buffer locked here.
+static int splicein(struct file *in, struct pipe *out, int n) {
+  struct inode *ip = in->ip;
+  struct buf *b;
+  int tot, m, r;
+  uint off;
+
+  for (tot = 0; tot < n; tot += r) {
+    if ((m = piperoom(out)) < 0) return tot > 0 ? tot : -1;
+    ilock(ip);
+    off = in->off;
+    if ((b = ibread(ip, off, n - tot)) == 0) {
+      iunlock(ip);
+      break;
+    }
+    if (m > n - tot) m = n - tot;
+    if (m > BSIZE - off % BSIZE) m = BSIZE - off % BSIZE;
+    if (m > ip->size - off) m = ip->size - off;
+    // pipeput() does not sleep, so the inode stays locked
+    // until in->off moves, as in fileread().
+    if ((r = pipeput(out, (char *)b->data + off % BSIZE, m)) > 0) in->off += r;
+    iunlock(ip);
+    brelse(b);
+    if (r < 0) return tot > 0 ? tot : -1;
+  }
+  return tot;
+}
+
+// Move up to n bytes from in to out inside the kernel,
+// without copying them through user space. One of the two
+// must be a pipe. From a pipe, move only what one read
+// returns, as read() would.
+int filesplice(struct file *in, struct file *out, int n) {
+  char *page;
+  int tot, r = 0;
+
+  if (in->readable == 0 || out->writable == 0 || n < 0) return -1;
+  if (in->type != FD_PIPE && out->type != FD_PIPE) return -1;
+  if (in->type == FD_INODE && out->type == FD_PIPE) return splicein(in, out->pipe, n);
+
+  // otherwise through a kernel page.
+  if ((page = kalloc()) == 0) return -1;
+  for (tot = 0; tot < n; tot += r) {
+    if ((r = fileread(in, 0, (uint64)page, n - tot < PGSIZE ? n - tot : PGSIZE)) <= 0) break;
+    if (filewrite(out, 0, (uint64)page, r) != r) {
+      r = -1;
+      break;
+    }
+    if (in->type == FD_PIPE) {
+      tot += r;
+      break;
+    }
+  }
+  kfree(page);
+  return tot > 0 || r == 0 ? tot : -1;
+}
@@ -26,7 +26,11 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT + 1];
+  uint addrs[NDIRECT + 2];
+
+  uint raoff;  // offset just past the last read, to spot sequential reads
+  uint rawin;  // read-ahead window in blocks; 0 after a non-sequential read
+  uint rapos;  // first block not yet read ahead
 };
 
 // map major device number to device functions.
@@ -22,6 +22,9 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define EXTRUN 16  // free run that a new extent starts in
+#define RAMIN 4    // first read-ahead window, in blocks
+#define RAMAX 32   // largest read-ahead window
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb;
@@ -39,6 +42,11 @@ static void readsb(int dev, struct superblock *sb) {
 void fsinit(int dev) {
   readsb(dev, &sb);
   if (sb.magic != FSMAGIC) panic("invalid file system");
+  // itrunc() frees a whole file, up to MAXFILE blocks, in one
+  // transaction, and may clear a bit in every bitmap block.
+  // With the inode, directory and parent blocks of an unlink(),
+  // that must stay within MAXOPBLOCKS: 25 + 4 for FSSIZE 200000.
+  if (sb.size / BPB + 1 + 4 > MAXOPBLOCKS) panic("fsinit: MAXOPBLOCKS too small for itrunc");
   initlog(dev, &sb);
 }
 
@@ -79,6 +87,55 @@ static uint balloc(uint dev) {
   return 0;
 }
 
+// Allocate the zeroed disk block b, if it is free.
+// returns 0 if b is in use.
+static uint ballocat(uint dev, uint b) {
+  struct buf *bp;
+  int bi, m;
+
+  if (b >= sb.size) return 0;
+  bp = bread(dev, BBLOCK(b, sb));
+  bi = b % BPB;
+  m = 1 << (bi % 8);
+  if (bp->data[bi / 8] & m) {
+    brelse(bp);
+    return 0;
+  }
+  bp->data[bi / 8] |= m;
+  log_write(bp);
+  brelse(bp);
+  bzero(dev, b);
+  return b;
+}
+
+// Allocate a zeroed disk block at the start of the first free
+// run of at least want blocks, so that the caller can grow
+// into the rest of the run. Falls back to any free block.
+// returns 0 if out of disk space.
+static uint ballocrun(uint dev, uint want) {
+  int b, bi;
+  uint start, n;
+  struct buf *bp;
+
+  for (;;) {
+    start = n = 0;
+    for (b = 0; b < sb.size && n < want; b += BPB) {
+      bp = bread(dev, BBLOCK(b, sb));
+      for (bi = 0; bi < BPB && b + bi < sb.size && n < want; bi++) {
+        if (bp->data[bi / 8] & (1 << (bi % 8))) {
+          n = 0;
+        } else if (n++ == 0) {
+          start = b + bi;
+        }
+      }
+      brelse(bp);
+    }
+    if (n < want) return balloc(dev);
+    // someone may have taken start since we looked.
+    if (ballocat(dev, start)) return start;
+  }
+}
+
 // Free a disk block.
 static void bfree(int dev, uint b) {
   struct buf *bp;
@@ -251,6 +308,7 @@ static struct inode *iget(uint dev, uint inum) {
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->raoff = ip->rawin = ip->rapos = 0;
   release(&itable.lock);
 
   return ip;
@@ -341,14 +399,118 @@ void iunlockput(struct inode *ip) {
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The next NDINDIRECT
+// blocks are listed in the indirect blocks listed in block
+// ip->addrs[NDIRECT+1]. On an FS_EXTENT file system, ip->addrs[]
+// holds extents instead; see ebmap().
+
+// Return the disk block address of the nth block of extent
+// inode ip. n may be one past the last mapped block, in which
+// case ebmap extends the last extent if the next disk block is
+// free, or else starts a new extent at a fresh free run.
+// returns 0 if out of disk space or extents.
+static uint ebmap(struct inode *ip, uint bn) {
+  struct extent *e, *last;
+  struct buf *bp;
+  uint base, addr;
+  int i;
+
+  bp = 0;
+  last = 0;
+  base = 0;
+  for (i = 0; i < NEXTENT + NEXTBLK; i++) {
+    if (i == NEXTENT) {
+      if (ip->addrs[NDIRECT + 1] == 0) break;
+      bp = bread(ip->dev, ip->addrs[NDIRECT + 1]);
+    }
+    e = i < NEXTENT ? (struct extent *)ip->addrs + i : (struct extent *)bp->data + (i - NEXTENT);
+    if (e->len == 0) break;
+    if (bn < base + e->len) {
+      addr = e->start + (bn - base);
+      if (bp) brelse(bp);
+      return addr;
+    }
+    base += e->len;
+    last = e;
+  }
+  if (bn != base) panic("ebmap: hole");
+
+  if (last && (addr = ballocat(ip->dev, last->start + last->len)) != 0) {
+    last->len++;
+  } else {
+    if (i == NEXTENT + NEXTBLK) {
+      addr = 0;
+      goto out;
+    }
+    if (i == NEXTENT && bp == 0) {
+      if ((addr = balloc(ip->dev)) == 0) goto out;
+      ip->addrs[NDIRECT + 1] = addr;
+      bp = bread(ip->dev, addr);
+    }
+    if ((addr = ballocrun(ip->dev, EXTRUN)) == 0) goto out;
+    e = i < NEXTENT ? (struct extent *)ip->addrs + i : (struct extent *)bp->data + (i - NEXTENT);
+    e->start = addr;
+    e->len = 1;
+  }
+  // the inline extents reach the disk with the caller's iupdate().
+  if (bp) log_write(bp);
+
+out:
+  if (bp) brelse(bp);
+  return addr;
+}
+
+// Free the blocks of extent inode ip.
+static void etrunc(struct inode *ip) {
+  struct extent *e;
+  struct buf *bp;
+  uint b;
+  int i;
+
+  bp = 0;
+  for (i = 0; i < NEXTENT + NEXTBLK; i++) {
+    if (i == NEXTENT) {
+      if (ip->addrs[NDIRECT + 1] == 0) break;
+      bp = bread(ip->dev, ip->addrs[NDIRECT + 1]);
+    }
+    e = i < NEXTENT ? (struct extent *)ip->addrs + i : (struct extent *)bp->data + (i - NEXTENT);
+    if (e->len == 0) break;
+    for (b = e->start; b < e->start + e->len; b++) bfree(ip->dev, b);
+  }
+  if (bp) {
+    brelse(bp);
+    bfree(ip->dev, ip->addrs[NDIRECT + 1]);
+  }
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+}
+
+// Return entry i of indirect block addr, allocating
+// a block for it if necessary.
+// returns 0 if out of disk space.
+static uint bmapind(uint dev, uint addr, uint i) {
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(dev, addr);
+  a = (uint *)bp->data;
+  if ((addr = a[i]) == 0) {
+    addr = balloc(dev);
+    if (addr) {
+      a[i] = addr;
+      log_write(bp);
+    }
+  }
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 // returns 0 if out of disk space.
 static uint bmap(struct inode *ip, uint bn) {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr;
+
+  if (sb.features & FS_EXTENT) return ebmap(ip, bn);
 
   if (bn < NDIRECT) {
     if ((addr = ip->addrs[bn]) == 0) {
@@ -367,28 +529,56 @@ static uint bmap(struct inode *ip, uint bn) {
       if (addr == 0) return 0;
       ip->addrs[NDIRECT] = addr;
     }
-    bp = bread(ip->dev, addr);
-    a = (uint *)bp->data;
-    if ((addr = a[bn]) == 0) {
+    return bmapind(ip->dev, addr, bn);
+  }
+  bn -= NINDIRECT;
+
+  if (bn < NDINDIRECT) {
+    // Load doubly-indirect block, then the indirect
+    // block below it, allocating if necessary.
+    if ((addr = ip->addrs[NDIRECT + 1]) == 0) {
       addr = balloc(ip->dev);
-      if (addr) {
-        a[bn] = addr;
-        log_write(bp);
-      }
+      if (addr == 0) return 0;
+      ip->addrs[NDIRECT + 1] = addr;
     }
-    brelse(bp);
-    return addr;
+    if ((addr = bmapind(ip->dev, addr, bn / NINDIRECT)) == 0) return 0;
+    return bmapind(ip->dev, addr, bn % NINDIRECT);
   }
 
   panic("bmap: out of range");
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void itrunc(struct inode *ip) {
-  int i, j;
+// Free block addr and, for an indirect block at
+// the given depth, every block it refers to.
+static void bfreeind(uint dev, uint addr, int depth) {
   struct buf *bp;
   uint *a;
+  int j;
+
+  if (depth > 0) {
+    bp = bread(dev, addr);
+    a = (uint *)bp->data;
+    for (j = 0; j < NINDIRECT; j++) {
+      if (a[j]) bfreeind(dev, a[j], depth - 1);
+    }
+    brelse(bp);
+  }
+  bfree(dev, addr);
+}
+
+// Truncate inode (discard contents).
+// Caller must hold ip->lock. This writes the inode and at
+// most every bitmap block, which fsinit() checks fits in
+// one transaction; indirect blocks are freed, not written.
+void itrunc(struct inode *ip) {
+  int i;
+
+  if (sb.features & FS_EXTENT) {
+    etrunc(ip);
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for (i = 0; i < NDIRECT; i++) {
     if (ip->addrs[i]) {
@@ -398,16 +588,15 @@ void itrunc(struct inode *ip) {
   }
 
   if (ip->addrs[NDIRECT]) {
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint *)bp->data;
-    for (j = 0; j < NINDIRECT; j++) {
-      if (a[j]) bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    bfreeind(ip->dev, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
 
+  if (ip->addrs[NDIRECT + 1]) {
+    bfreeind(ip->dev, ip->addrs[NDIRECT + 1], 2);
+    ip->addrs[NDIRECT + 1] = 0;
+  }
+
   ip->size = 0;
   iupdate(ip);
 }
@@ -422,32 +611,84 @@ void stati(struct inode *ip, struct stat *st) {
   st->size = ip->size;
 }
 
+// Sequential read-ahead for a read of n bytes at off.
+// A read that starts where the last one ended doubles the
+// window, up to RAMAX; any other read closes it. Once less
+// than half a window lies read ahead of the read's end, start
+// reading the next window's worth of blocks into the cache.
+static void readahead(struct inode *ip, uint off, uint n) {
+  uint bn, end, addr, nb;
+
+  if (off != ip->raoff) {
+    ip->raoff = off + n;
+    ip->rawin = 0;
+    ip->rapos = 0;
+    return;
+  }
+  ip->raoff = off + n;
+  ip->rawin = ip->rawin == 0 ? RAMIN : min(2 * ip->rawin, RAMAX);
+
+  bn = (off + n + BSIZE - 1) / BSIZE;  // first block past this read
+  if (ip->rapos > bn + ip->rawin / 2) return;
+  end = min(bn + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+  if (bn < ip->rapos) bn = ip->rapos;
+
+  while (bn < end) {
+    if ((addr = bmap(ip, bn)) == 0) break;
+    for (nb = 1; nb < NBULK && bn + nb < end && bmap(ip, bn + nb) == addr + nb; nb++);
+    breadahead(ip->dev, addr, nb);
+    bn += nb;
+  }
+  ip->rapos = bn;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
 int readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n) {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, bn, nb, i;
+  struct buf *bs[NBULK];
 
   if (off > ip->size || off + n < off) return 0;
   if (off + n > ip->size) n = ip->size - off;
 
-  for (tot = 0; tot < n; tot += m, off += m, dst += m) {
-    uint addr = bmap(ip, off / BSIZE);
+  readahead(ip, off, n);
+
+  for (tot = 0; tot < n;) {
+    bn = off / BSIZE;
+    uint addr = bmap(ip, bn);
     if (addr == 0) break;
-    bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off % BSIZE);
-    if (either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
-      brelse(bp);
-      tot = -1;
-      break;
+    // the following blocks of the read that also follow
+    // addr on disk come in with the same disk request.
+    for (nb = 1; nb < NBULK && (bn + nb) * BSIZE < off + (n - tot) && bmap(ip, bn + nb) == addr + nb; nb++);
+    breadn(ip->dev, addr, nb, bs);
+    for (i = 0; i < nb; i++, tot += m, off += m, dst += m) {
+      m = min(n - tot, BSIZE - off % BSIZE);
+      if (either_copyout(user_dst, dst, bs[i]->data + (off % BSIZE), m) == -1) {
+        while (i < nb) brelse(bs[i++]);
+        return -1;
+      }
+      brelse(bs[i]);
     }
-    brelse(bp);
   }
   return tot;
 }
 
+// Return the locked buf holding byte off of ip, or 0 if
+// off is at or past the end. n is how much the caller
+// means to read from off, for read-ahead.
+// Caller must hold ip->lock.
+struct buf *ibread(struct inode *ip, uint off, uint n) {
+  uint addr;
+
+  if (off >= ip->size) return 0;
+  if (n > ip->size - off) n = ip->size - off;
+  readahead(ip, off, n);
+  if ((addr = bmap(ip, off / BSIZE)) == 0) return 0;
+  return bread(ip->dev, addr);
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -19,13 +19,28 @@ struct superblock {
   uint logstart;    // Block number of first log block
   uint inodestart;  // Block number of first inode block
   uint bmapstart;   // Block number of first free map block
+  uint features;    // FS_* flags; 0 on older images
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define FS_EXTENT 0x1  // inodes map blocks with extents
+
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
+
+// On an FS_EXTENT file system, addrs[] instead holds NEXTENT
+// extents, and addrs[NDIRECT+1] names a block of NEXTBLK more.
+// A file's extents map its blocks in order, with no holes.
+struct extent {
+  uint start;  // first block of the run
+  uint len;    // number of blocks; 0 ends the list
+};
+
+#define NEXTENT ((NDIRECT + 1) / 2)
+#define NEXTBLK (BSIZE / sizeof(struct extent))
 
 // On-disk inode structure
 struct dinode {
@@ -34,7 +49,7 @@ struct dinode {
   short minor;              // Minor device number (T_DEVICE only)
   short nlink;              // Number of links to inode in file system
   uint size;                // Size of file (bytes)
-  uint addrs[NDIRECT + 1];  // Data block addresses
+  uint addrs[NDIRECT + 2];  // Data block addresses
 };
 
 // Inodes per block.
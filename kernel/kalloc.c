@@ -1,57 +1,338 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or aligned runs of 2^order of them.
+//
+// All free memory belongs to a buddy allocator in kmem, with a
+// free list per order. kalloc_pages(order) splits a larger block
+// if it must, and kfree_pages() merges a freed block with its
+// buddy, and that block with its own buddy, as far as it can.
+//
+// Each CPU keeps its own list of single free pages in struct cpu,
+// so kalloc() and kfree() usually touch only CPU-local state.
+// Pages move between the per-CPU lists and the buddy allocator in
+// batches of KBATCH. A CPU whose list and the buddy allocator are
+// both empty steals pages from the other CPUs before kalloc()
+// gives up.
+//
+// Pages shared copy-on-write after fork() carry a reference
+// count; kfree() only frees a page when its last reference goes.
+// Each page of a block from kalloc_pages() has a count of one, so
+// that a superpage split into ordinary pages is freed a page at a
+// time, and the pages coalesce again in the buddy allocator.
+//
+// Idle CPUs keep a pool of up to KZERO pages zeroed ahead of
+// time, so that kalloc_zeroed() can hand out page-table and
+// user pages without clearing them on the caller's time.
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "proc.h"
 #include "defs.h"
+#include "kstat.h"
+
+#define KBATCH 32           // pages moved per refill, drain or steal
+#define KHIGH (2 * KBATCH)  // drain a CPU's list when it grows past this
+#define KZERO 128           // pre-zeroed pages to keep
 
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[];  // first address after kernel.
                     // defined by kernel.ld.
 
+// Reference count of each physical page, indexed by PA2REF(pa).
+// Updated with atomic instructions rather than under a lock.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+int pageref[PA2REF(PHYSTOP)];
+
 struct run {
   struct run *next;
 };
 
+// A free block in the buddy allocator.
+struct block {
+  struct block *next;
+  struct block *prev;
+};
+
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct block *free[MAXORDER + 1];  // free blocks of each order
+  int nblock[MAXORDER + 1];
+  int nfree;                         // pages in all the free blocks
+  uint64 nalloc[MAXORDER + 1];       // kalloc_pages() calls of each order
+  uchar head[PA2REF(PHYSTOP)];       // order+1 of the free block starting at each page, or 0
 } kmem;
 
+struct {
+  struct spinlock lock;
+  struct run *freelist;  // zeroed but for the next field
+  int nfree;
+  uint64 hit;   // kalloc_zeroed()s served from the pool, atomic
+  uint64 miss;  // kalloc_zeroed()s that found it empty, atomic
+} kzero;
+
 void kinit() {
+  struct cpu *c;
+
   initlock(&kmem.lock, "kmem");
+  initlock(&kzero.lock, "kzero");
+  for (c = cpus; c < &cpus[NCPU]; c++) initlock(&c->kmemlock, "kmem_cpu");
   freerange(end, (void *)PHYSTOP);
 }
 
+static void buddyput(char *pa, int order);
+
+// Hand [pa_start, pa_end) to the buddy allocator, as the
+// largest aligned blocks that fit.
 void freerange(void *pa_start, void *pa_end) {
   char *p;
+  int k;
+
   p = (char *)PGROUNDUP((uint64)pa_start);
-  for (; p + PGSIZE <= (char *)pa_end; p += PGSIZE) kfree(p);
+  acquire(&kmem.lock);
+  while (p + PGSIZE <= (char *)pa_end) {
+    for (k = 0; k < MAXORDER && (uint64)p % (PGSIZE << (k + 1)) == 0 && p + (PGSIZE << (k + 1)) <= (char *)pa_end; k++);
+    buddyput(p, k);
+    p += PGSIZE << k;
+  }
+  release(&kmem.lock);
+}
+
+// Add a reference to the page at pa, which is
+// about to be shared by another page table.
+void kaddref(void *pa) {
+  if (((uint64)pa % PGSIZE) != 0 || (char *)pa < end || (uint64)pa >= PHYSTOP) panic("kaddref");
+  if (__sync_fetch_and_add(&pageref[PA2REF(pa)], 1) < 1) panic("kaddref: free page");
+}
+
+// Return the number of references to the page at pa.
+int krefcnt(void *pa) { return __atomic_load_n(&pageref[PA2REF(pa)], __ATOMIC_SEQ_CST); }
+
+// Add the free block at pa to the free list of its order.
+// Caller holds kmem.lock.
+static void blockpush(char *pa, int order) {
+  struct block *b = (struct block *)pa;
+
+  b->prev = 0;
+  b->next = kmem.free[order];
+  if (b->next) b->next->prev = b;
+  kmem.free[order] = b;
+  kmem.nblock[order]++;
+  kmem.head[PA2REF(pa)] = order + 1;
+}
+
+// Remove the free block at pa from the free list of its order.
+// Caller holds kmem.lock.
+static void blockunlink(char *pa, int order) {
+  struct block *b = (struct block *)pa;
+
+  if (b->prev)
+    b->prev->next = b->next;
+  else
+    kmem.free[order] = b->next;
+  if (b->next) b->next->prev = b->prev;
+  kmem.nblock[order]--;
+  kmem.head[PA2REF(pa)] = 0;
+}
+
+// Free the block of 2^order pages at pa, merging it with its
+// buddy for as long as the buddy is free too.
+// Caller holds kmem.lock.
+static void buddyput(char *pa, int order) {
+  char *buddy;
+
+  kmem.nfree += 1 << order;
+  for (; order < MAXORDER; order++) {
+    buddy = (char *)((uint64)pa ^ (PGSIZE << order));
+    if (buddy < end || (uint64)buddy >= PHYSTOP || kmem.head[PA2REF(buddy)] != order + 1) break;
+    blockunlink(buddy, order);
+    if (buddy < pa) pa = buddy;
+  }
+  blockpush(pa, order);
+}
+
+// Take a block of 2^order pages, splitting a larger block if
+// there is none of that order. Returns 0 if there is none.
+// Caller holds kmem.lock.
+static char *buddyget(int order) {
+  char *pa;
+  int k;
+
+  for (k = order; k <= MAXORDER && kmem.free[k] == 0; k++);
+  if (k > MAXORDER) return 0;
+  pa = (char *)kmem.free[k];
+  blockunlink(pa, k);
+  // give back the upper half until the block is the right size.
+  while (k > order) {
+    k--;
+    blockpush(pa + (PGSIZE << k), k);
+  }
+  kmem.nfree -= 1 << order;
+  return pa;
+}
+
+// Take up to n single pages from the buddy allocator.
+// Returns them as a chain; *got is set to its length.
+static struct run *buddytake(int n, int *got) {
+  struct run *chain, *r;
+
+  chain = 0;
+  acquire(&kmem.lock);
+  for (*got = 0; *got < n && (r = (struct run *)buddyget(0)) != 0; (*got)++) {
+    r->next = chain;
+    chain = r;
+  }
+  release(&kmem.lock);
+  return chain;
+}
+
+// Give a chain of single pages back to the buddy allocator.
+static void buddygive(struct run *chain) {
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while ((r = chain) != 0) {
+    chain = r->next;
+    buddyput((char *)r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Detach up to n pages from the list *head, which holds *cnt pages.
+// Returns the detached chain; *got is set to its length.
+static struct run *takepages(struct run **head, int *cnt, int n, int *got) {
+  struct run *first, *r;
+  int i;
+
+  *got = 0;
+  if ((first = *head) == 0 || n <= 0) return 0;
+  for (r = first, i = 1; i < n && r->next; i++) r = r->next;
+  *head = r->next;
+  r->next = 0;
+  *cnt -= i;
+  *got = i;
+  return first;
+}
+
+// Prepend a chain of n pages to the list *head.
+static void putpages(struct run **head, int *cnt, struct run *chain, int n) {
+  struct run *r;
+
+  if (chain == 0) return;
+  for (r = chain; r->next; r = r->next);
+  r->next = *head;
+  *head = chain;
+  *cnt += n;
+}
+
+// Take pages from some other CPU's free list.
+// Returns the stolen chain, *got is set to its length.
+static struct run *steal(struct cpu *self, int *got) {
+  struct cpu *c;
+  struct run *chain;
+
+  for (c = cpus; c < &cpus[NCPU]; c++) {
+    if (c == self) continue;
+    acquire(&c->kmemlock);
+    chain = takepages(&c->freelist, &c->nfree, (c->nfree + 1) / 2 < KBATCH ? (c->nfree + 1) / 2 : KBATCH, got);
+    release(&c->kmemlock);
+    if (chain) return chain;
+  }
+  return 0;
+}
+
+// Take a page from the zeroed pool, or return 0.
+static struct run *kzerotake(void) {
+  struct run *r;
+
+  acquire(&kzero.lock);
+  if ((r = kzero.freelist) != 0) {
+    kzero.freelist = r->next;
+    kzero.nfree--;
+  }
+  release(&kzero.lock);
+  return r;
 }
 
-// Free the page of physical memory pointed at by pa,
+// Drop a reference to the page of physical memory pointed at by pa,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when the last reference goes.
 void kfree(void *pa) {
-  struct run *r;
+  struct run *r, *chain;
+  struct cpu *c;
+  int n;
 
   if (((uint64)pa % PGSIZE) != 0 || (char *)pa < end || (uint64)pa >= PHYSTOP) panic("kfree");
 
+  if ((n = __sync_sub_and_fetch(&pageref[PA2REF(pa)], 1)) > 0) return;
+  if (n < 0) panic("kfree: free page");
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run *)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  c = mycpu();
+  acquire(&c->kmemlock);
+  r->next = c->freelist;
+  c->freelist = r;
+  c->nfree++;
+  if (c->nfree > KHIGH) {
+    // give a batch back to the buddy allocator.
+    chain = takepages(&c->freelist, &c->nfree, KBATCH, &n);
+    buddygive(chain);
+  }
+  release(&c->kmemlock);
+  pop_off();
+}
+
+// Take a free page from this CPU's list, the buddy allocator
+// or another CPU, but not from the zeroed pool.
+// Returns 0 if there is none.
+static struct run *kallocfree(void) {
+  struct run *r, *chain;
+  struct cpu *c;
+  int n, stolen;
+
+  // stay on this CPU so that c remains ours.
+  push_off();
+  c = mycpu();
+
+  acquire(&c->kmemlock);
+  if ((r = c->freelist) != 0) {
+    c->freelist = r->next;
+    c->nfree--;
+    c->khit++;
+  } else {
+    c->kmiss++;
+  }
+  release(&c->kmemlock);
+
+  if (r == 0) {
+    // refill from the buddy allocator, or failing that, from
+    // another CPU. c->kmemlock is not held, so that two CPUs
+    // stealing from each other cannot deadlock.
+    stolen = 0;
+    chain = buddytake(KBATCH, &n);
+    if (chain == 0 && (chain = steal(c, &n)) != 0) stolen = 1;
+
+    if (chain) {
+      r = chain;
+      acquire(&c->kmemlock);
+      putpages(&c->freelist, &c->nfree, r->next, n - 1);
+      if (stolen) c->ksteal++;
+      release(&c->kmemlock);
+    }
+  }
+  pop_off();
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -60,11 +341,157 @@ void kfree(void *pa) {
 void *kalloc(void) {
   struct run *r;
 
+  // the last free pages may be in the zeroed pool, or held
+  // by slab caches that could give some back.
+  if ((r = kallocfree()) == 0) r = kzerotake();
+  if (r == 0 && slabshrink() > 0) r = kallocfree();
+
+  if (r) {
+    pageref[PA2REF(r)] = 1;
+    memset((char *)r, 5, PGSIZE);  // fill with junk
+  }
+  return (void *)r;
+}
+
+// Allocate one page of zeroed physical memory,
+// from the pool if it has one.
+// Returns 0 if the memory cannot be allocated.
+void *kalloc_zeroed(void) {
+  struct run *r;
+
+  if ((r = kzerotake()) != 0) {
+    __sync_fetch_and_add(&kzero.hit, 1);
+    r->next = 0;
+    pageref[PA2REF(r)] = 1;
+  } else {
+    __sync_fetch_and_add(&kzero.miss, 1);
+    if ((r = kalloc()) != 0) memset((char *)r, 0, PGSIZE);
+  }
+  return (void *)r;
+}
+
+// Called by a CPU with nothing to run: zero a page for the
+// pool if it is short of KZERO. Returns 1 if it did. The page
+// never comes from the pool itself, or a CPU would go round
+// taking, zeroing and returning the last pages forever.
+int kzerofill(void) {
+  struct run *r;
+
+  if (__atomic_load_n(&kzero.nfree, __ATOMIC_RELAXED) >= KZERO) return 0;
+  if ((r = kallocfree()) == 0) return 0;
+  memset((char *)r, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  r->next = kzero.freelist;
+  kzero.freelist = r;
+  kzero.nfree++;
+  release(&kzero.lock);
+  return 1;
+}
+
+// Return every CPU's free pages, and the zeroed pool, to the
+// buddy allocator, so that they can coalesce into larger blocks.
+// Idle CPUs refill the pool from the smallest free blocks.
+static void kdrain(void) {
+  struct cpu *c;
+  struct run *chain;
+
+  for (c = cpus; c < &cpus[NCPU]; c++) {
+    acquire(&c->kmemlock);
+    chain = c->freelist;
+    c->freelist = 0;
+    c->nfree = 0;
+    release(&c->kmemlock);
+    buddygive(chain);
+  }
+
+  acquire(&kzero.lock);
+  chain = kzero.freelist;
+  kzero.freelist = 0;
+  kzero.nfree = 0;
+  release(&kzero.lock);
+  buddygive(chain);
+}
+
+// Allocate 2^order pages of physically contiguous memory,
+// aligned to their size and not zeroed.
+// Returns 0 if the memory cannot be allocated.
+void *kalloc_pages(int order) {
+  char *pa;
+  int i;
+
+  if (order < 0 || order > MAXORDER) panic("kalloc_pages");
+
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if (r) kmem.freelist = r->next;
+  pa = buddyget(order);
+  if (pa) kmem.nalloc[order]++;
   release(&kmem.lock);
 
-  if (r) memset((char *)r, 5, PGSIZE);  // fill with junk
-  return (void *)r;
+  if (pa == 0 && order > 0) {
+    // the pages that would complete a block may be
+    // sitting on the per-CPU lists.
+    kdrain();
+    acquire(&kmem.lock);
+    pa = buddyget(order);
+    if (pa) kmem.nalloc[order]++;
+    release(&kmem.lock);
+  }
+
+  if (pa) {
+    for (i = 0; i < (1 << order); i++) pageref[PA2REF(pa + i * PGSIZE)] = 1;
+  }
+  return (void *)pa;
+}
+
+// Free 2^order pages that kalloc_pages(order) returned
+// and that no one else refers to.
+void kfree_pages(void *pa, int order) {
+  int i;
+
+  if (order < 0 || order > MAXORDER || ((uint64)pa % (PGSIZE << order)) != 0 || (char *)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kfree_pages");
+  for (i = 0; i < (1 << order); i++) {
+    if (pageref[PA2REF((char *)pa + i * PGSIZE)] != 1) panic("kfree_pages: shared");
+    pageref[PA2REF((char *)pa + i * PGSIZE)] = 0;
+  }
+
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, PGSIZE << order);
+
+  acquire(&kmem.lock);
+  buddyput((char *)pa, order);
+  release(&kmem.lock);
+}
+
+// Report the free page counts and the per-CPU
+// allocation counters.
+void kmemstat(struct kmemstat *st) {
+  struct cpu *c;
+  int i;
+
+  memset(st, 0, sizeof(*st));
+
+  acquire(&kmem.lock);
+  st->gfree = kmem.nfree;
+  for (i = 0; i <= MAXORDER; i++) {
+    st->bfree[i] = kmem.nblock[i];
+    st->balloc[i] = kmem.nalloc[i];
+  }
+  release(&kmem.lock);
+
+  acquire(&kzero.lock);
+  st->zfree = kzero.nfree;
+  st->zhit = kzero.hit;
+  st->zmiss = kzero.miss;
+  release(&kzero.lock);
+
+  for (i = 0; i < NCPU; i++) {
+    c = &cpus[i];
+    acquire(&c->kmemlock);
+    st->cpu[i].nfree = c->nfree;
+    st->cpu[i].hit = c->khit;
+    st->cpu[i].miss = c->kmiss;
+    st->cpu[i].steal = c->ksteal;
+    release(&c->kmemlock);
+  }
 }
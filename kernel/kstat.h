@@ -0,0 +1,71 @@
+// Kernel statistics exported to user programs.
+// Both the kernel and user programs use this header file.
+
+// Physical page allocator, from kalloc.c.
+struct kmemstat {
+  uint64 gfree;                 // pages in the buddy allocator
+  uint64 bfree[MAXORDER + 1];   // free blocks of each order in it
+  uint64 balloc[MAXORDER + 1];  // kalloc_pages() calls of each order
+  uint64 zfree;                 // pages in the zeroed pool
+  uint64 zhit;                  // kalloc_zeroed()s served from the zeroed pool
+  uint64 zmiss;                 // kalloc_zeroed()s that had to zero a page
+  struct {
+    uint64 nfree;  // pages on this CPU's free list
+    uint64 hit;    // kalloc()s served from the local list
+    uint64 miss;   // kalloc()s that found the local list empty
+    uint64 steal;  // misses refilled with pages stolen from another CPU
+  } cpu[NCPU];
+};
+
+// Read-ahead in the buffer cache, from bio.c.
+struct rastat {
+  uint64 issued;  // blocks read ahead
+  uint64 hit;     // blocks read ahead and then used
+  uint64 waste;   // blocks read ahead and recycled unused
+};
+
+// The scheduler, from proc.c.
+struct schedstat {
+  struct {
+    uint64 runs;    // processes switched to
+    uint64 steals;  // of those, taken from another CPU's queues
+    uint64 busy;    // timer interrupts taken running a process
+    uint64 idle;    // timer interrupts taken idle
+    uint64 nready;  // processes waiting in the run queues
+  } cpu[NCPU];
+};
+
+// Run queue latency, the time from RUNNABLE to RUNNING,
+// from proc.c. hist[i] counts waits of [2^i, 2^(i+1))
+// microseconds; hist[0] also counts shorter ones, and the
+// last bucket longer ones.
+#define NLATBUCKET 20
+
+struct schedlat {
+  uint64 n;      // waits measured
+  uint64 total;  // their sum, microseconds
+  uint64 max;    // the longest, microseconds
+  uint64 hist[NLATBUCKET];
+};
+
+// Slab caches, from slab.c. Unused entries have size 0.
+struct slabstat {
+  struct {
+    char name[16];
+    uint64 size;     // object size, bytes
+    uint64 perslab;  // objects in each one-page slab
+    uint64 slabs;    // slabs, and so pages, the cache holds
+    uint64 inuse;    // objects allocated
+    uint64 cached;   // free objects in the per-CPU magazines
+    uint64 alloc;    // kmem_cache_alloc()s
+  } cache[NCACHE];
+};
+
+// The write-ahead log, from log.c.
+struct logstat {
+  uint64 commits;      // transactions committed
+  uint64 logged;       // blocks written to the log
+  uint64 absorbed;     // of those, replaced in the log by a later commit
+  uint64 installed;    // blocks written home by checkpoints
+  uint64 checkpoints;  // checkpoints
+};
@@ -6,6 +6,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "kstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -21,6 +22,28 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// If COMMITTICKS is not 0, end_op() does not commit by
+// itself. The logflusher thread asks for a commit once the
+// open transaction is COMMITTICKS old, and log_sync(), for
+// fsync() and sync(), asks for one at once. New ops then
+// wait until the last outstanding end_op() commits. A crash
+// loses at most the last COMMITTICKS of system calls, but
+// never part of one.
+//
+// Logging is double-buffered. Once the last op of the open
+// transaction ends, its blocks are copied into log buffers, and
+// from then on the copies are what gets committed. New ops may
+// begin as soon as the copy is done, in a fresh open transaction,
+// while the old one is written to the log.
+//
+// Committed blocks are not installed at their home locations
+// right away. Each commit appends to the log, and the blocks
+// stay there, pinned in the cache, until the log has no room
+// for the next transaction. Then a checkpoint installs them
+// all and empties the log. A block committed several times
+// since the last checkpoint, like a bitmap or inode block,
+// goes home only once, with its latest contents.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -28,6 +51,8 @@
 //   block B
 //   block C
 //   ...
+// The same block # may appear more than once; the last
+// copy is the current one.
 // Log appends are synchronous.
 
 // Contents of the header block, used for both the on-disk header block
@@ -41,15 +66,29 @@ struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;          // max blocks in the log, at most LOGSIZE
   int outstanding;  // how many FS sys calls are executing.
-  int committing;   // in commit(), please wait.
+  int committing;   // a transaction is being committed.
+  int copying;      // commit is copying blocks; new ops wait.
+  int want;         // commit the open transaction soon.
+  uint64 opened;    // time when the open transaction began
+  int seq;          // sequence number of the open transaction
+  int done;         // sequence number of the last one committed
   int dev;
-  struct logheader lh;
+  struct logheader lh;   // the open transaction
+  struct logheader clh;  // the transaction being committed
+  struct logheader dh;   // the log on disk: home block # of each slot
+  // per log slot, pinned until the next checkpoint;
+  // 0 if a later slot holds a newer copy of the block.
+  struct buf *slot[LOGSIZE];  // the slot's log block
+  struct buf *home[LOGSIZE];  // the cached home block
+  struct logstat st;
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void logflusher(void);
 
 void initlog(int dev, struct superblock *sb) {
   if (sizeof(struct logheader) >= BSIZE) panic("initlog: too big logheader");
@@ -57,47 +96,105 @@ void initlog(int dev, struct superblock *sb) {
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  // file systems made before the log grew have a smaller one.
+  log.cap = log.size - 1 < LOGSIZE ? log.size - 1 : LOGSIZE;
   log.dev = dev;
+  log.seq = 1;
   recover_from_log();
+  if (COMMITTICKS > 0) kthread(logflusher, "logflusher");
+}
+
+// Does a slot after slot i hold the same block?
+static int superseded(int i) {
+  int j;
+
+  for (j = i + 1; j < log.dh.n; j++) {
+    if (log.dh.block[j] == log.dh.block[i]) return 1;
+  }
+  return 0;
 }
 
-// Copy committed blocks from log to their home location
-static void install_trans(int recovering) {
-  int tail;
+// Copy the blocks of the log left by a crash, described by
+// log.dh, from log to their home location.
+// Each run of consecutive home blocks is read from the log
+// and written home with one disk request; all the writes
+// are in flight at once.
+static void recover_trans(void) {
+  struct buf *lbuf[NBULK], **dbuf = log.home;
+  int tail, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start + tail + 1);  // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]);    // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);                   // copy block to dst
-    bwrite(dbuf);                                             // write dst to disk
-    if (recovering == 0) bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < log.dh.n; tail += n) {
+    if (superseded(tail)) {
+      dbuf[tail] = 0;
+      n = 1;
+      continue;
+    }
+    for (n = 1; n < NBULK && tail + n < log.dh.n && log.dh.block[tail + n] == log.dh.block[tail] + n && !superseded(tail + n); n++);
+    breadn(log.dev, log.start + tail + 1, n, lbuf);  // read log blocks
+    for (i = 0; i < n; i++) {
+      dbuf[tail + i] = bgetw(log.dev, log.dh.block[tail + i]);  // dst, overwritten below
+      memmove(dbuf[tail + i]->data, lbuf[i]->data, BSIZE);     // copy block to dst
+      brelse(lbuf[i]);
+    }
+    bwrite_async(dbuf + tail, n);  // write dst to disk
+  }
+  for (tail = 0; tail < log.dh.n; tail++) {
+    if (dbuf[tail] == 0) continue;
+    bwait(dbuf[tail]);
+    brelse(dbuf[tail]);
+    dbuf[tail] = 0;
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Copy the current committed blocks from their log
+// buffers to their home locations on disk.
+// The open transaction may have changed the cached home
+// blocks since they were committed, so the copies go
+// straight from the log buffers, leaving the cache alone.
+// Each run of consecutive home blocks is one disk request.
+static void install_trans(void) {
+  int tail, i, n;
+
+  for (tail = 0; tail < log.dh.n; tail += n) {
+    if (log.slot[tail] == 0) {
+      n = 1;
+      continue;
+    }
+    for (n = 1; n < NBULK && tail + n < log.dh.n && log.slot[tail + n] && log.dh.block[tail + n] == log.dh.block[tail] + n; n++);
+    for (i = tail; i < tail + n; i++) {
+      // only the committer uses log blocks, so this does not wait.
+      if (bread(log.dev, log.start + i + 1) != log.slot[i]) panic("install_trans");
+    }
+    bwrite_at(log.slot + tail, n, log.dh.block[tail]);
+    log.st.installed += n;
+  }
+  for (tail = 0; tail < log.dh.n; tail++) {
+    if (log.slot[tail]) bwait(log.slot[tail]);
+  }
+}
+
+// Read the log header from disk into log.dh.
 static void read_head(void) {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *)(buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.dh.n = lh->n;
+  for (i = 0; i < log.dh.n; i++) {
+    log.dh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write log.dh to the on-disk log header.
 // This is the true point at which the
 // current transaction commits.
 static void write_head(void) {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *)(buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.dh.n;
+  for (i = 0; i < log.dh.n; i++) {
+    hb->block[i] = log.dh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -105,20 +202,45 @@ static void write_head(void) {
 
 static void recover_from_log(void) {
   read_head();
-  install_trans(1);  // if committed, copy from log to disk
-  log.lh.n = 0;
+  recover_trans();  // if committed, copy from log to disk
+  log.dh.n = 0;
   write_head();  // clear the log
 }
 
+// Install the log's blocks and empty it.
+static void checkpoint(void) {
+  int i;
+
+  install_trans();  // Install the latest copies at home
+  log.dh.n = 0;
+  write_head();  // Erase the transactions from the log
+  for (i = 0; i < LOGSIZE; i++) {
+    if (log.slot[i] == 0) continue;
+    bunpin(log.home[i]);
+    bunpin(log.slot[i]);
+    brelse(log.slot[i]);
+    log.slot[i] = log.home[i] = 0;
+  }
+  log.st.checkpoints++;
+}
+
+static int maybe_commit(void);
+
 // called at the start of each FS system call.
 void begin_op(void) {
   acquire(&log.lock);
   while (1) {
-    if (log.committing) {
-      sleep(&log, &log.lock);
-    } else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > LOGSIZE) {
-      // this op might exhaust log space; wait for commit.
+    if (log.copying) {
       sleep(&log, &log.lock);
+    } else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > log.cap) {
+      // this op might exhaust log space; wait for commit,
+      // or, if the ops in progress have written nothing yet,
+      // for one of them to end.
+      if (log.lh.n > 0) log.want = 1;
+      if (!maybe_commit()) sleep(&log, &log.lock);
+    } else if (COMMITTICKS > 0 && log.want && log.lh.n > 0) {
+      // a commit is due; let the ops in it finish first.
+      if (!maybe_commit()) sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
       release(&log.lock);
@@ -128,57 +250,186 @@ void begin_op(void) {
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and a commit is due, unless another commit is still
+// in progress; that one picks up this transaction when
+// it is done.
 void end_op(void) {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if (log.committing) panic("log.committing");
-  if (log.outstanding == 0) {
-    do_commit = 1;
-    log.committing = 1;
-  } else {
+  if (!maybe_commit()) {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
     // the amount of reserved space.
     wakeup(&log);
   }
   release(&log.lock);
+}
+
+// Commit the open transaction if it is due and no ops are
+// in it, and return 1, or return 0 if there is nothing to do.
+// A transaction is due at once if COMMITTICKS is 0, else
+// when log.want says so. Caller holds log.lock.
+static int maybe_commit(void) {
+  if (log.committing || log.outstanding > 0 || log.lh.n == 0) return 0;
+  if (COMMITTICKS > 0 && !log.want) return 0;
+  log.committing = 1;
+  commit();
+  return 1;
+}
+
+// Wait until everything done by FS system calls that have
+// ended is on disk, committing it now if need be.
+void log_sync(void) {
+  int seq;
+
+  acquire(&log.lock);
+  seq = log.lh.n > 0 ? log.seq : log.seq - 1;
+  if (log.done < seq && log.lh.n > 0) {
+    log.want = 1;
+    maybe_commit();
+  }
+  while (log.done < seq) sleep(&log, &log.lock);
+  release(&log.lock);
+}
+
+// Kernel thread that commits each transaction once it
+// has been open for COMMITTICKS, bounding how much a crash
+// can lose when end_op() does not commit.
+static void logflusher(void) {
+  uint64 due;
+  int seq;
 
-  if (do_commit) {
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
+  while (1) {
     acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+    while (log.lh.n == 0) sleep(&log.opened, &log.lock);
+    due = log.opened + COMMITTICKS * TICKCYCLES;
+    release(&log.lock);
+
+    sleepuntil(due);
+
+    acquire(&log.lock);
+    if (log.lh.n > 0 && r_time() - log.opened >= COMMITTICKS * TICKCYCLES) {
+      log.want = 1;
+      if (!maybe_commit()) {
+        // ops are outstanding or a commit is running; the
+        // last op to end, or that commit, takes this one.
+        // Wait for it rather than waking at a past deadline.
+        seq = log.seq;
+        while (log.done < seq) sleep(&log, &log.lock);
+      }
+    }
     release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
-static void write_log(void) {
-  int tail;
+// Copy modified blocks from cache to log buffers for the
+// slots after the log's last, which write_log() then
+// writes to disk. The home blocks stay pinned, and
+// the log buffers locked.
+static void copy_log(void) {
+  int i, s;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start + tail + 1);  // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]);  // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+  for (i = 0; i < log.clh.n; i++) {
+    s = log.dh.n + i;
+    log.slot[s] = bgetw(log.dev, log.start + s + 1);     // log block
+    struct buf *from = bread(log.dev, log.clh.block[i]);  // cache block
+    memmove(log.slot[s]->data, from->data, BSIZE);
+    log.home[s] = from;
     brelse(from);
-    brelse(to);
   }
 }
 
+// Write the log buffers copy_log() filled to the log.
+// The log is contiguous, so it goes out NBULK blocks per
+// request, with all the requests in flight at once.
+static void write_log(void) {
+  struct buf **to = log.slot + log.dh.n;
+  int tail, n;
+
+  for (tail = 0; tail < log.clh.n; tail += n) {
+    n = log.clh.n - tail < NBULK ? log.clh.n - tail : NBULK;
+    bwrite_async(to + tail, n);  // write the log
+  }
+  for (tail = 0; tail < log.clh.n; tail++) bwait(to[tail]);
+}
+
+// Add the transaction just written to the log to log.dh.
+// Copies of its blocks in earlier slots are now stale, so
+// unpin them; a checkpoint will install the new copies.
+static void append_trans(void) {
+  int i, j, s;
+
+  for (i = 0; i < log.clh.n; i++) {
+    s = log.dh.n + i;
+    log.dh.block[s] = log.clh.block[i];
+    for (j = 0; j < log.dh.n; j++) {
+      if (log.slot[j] && log.dh.block[j] == log.clh.block[i]) {
+        bunpin(log.home[j]);
+        bunpin(log.slot[j]);
+        log.slot[j] = log.home[j] = 0;
+        log.st.absorbed++;
+      }
+    }
+    bpin(log.slot[s]);
+    brelse(log.slot[s]);
+  }
+  log.dh.n += log.clh.n;
+}
+
+// Commit the open transaction, and then any transaction that
+// became due while this one was going to disk.
+// Called with log.lock held, log.committing set and no ops
+// outstanding. Releases log.lock during disk I/O.
 static void commit() {
-  if (log.lh.n > 0) {
-    write_log();       // Write modified blocks from cache to log
-    write_head();      // Write header to disk -- the real commit
-    install_trans(0);  // Now install writes to home locations
+  int seq;
+
+  while (log.outstanding == 0 && log.lh.n > 0 && (COMMITTICKS == 0 || log.want)) {
+    if (log.dh.n + log.lh.n > log.cap) {
+      // no room in the log; make some, while new ops
+      // carry on. If they do, the last one commits.
+      release(&log.lock);
+      checkpoint();
+      acquire(&log.lock);
+      continue;
+    }
+
+    // take over the open transaction, and hold off
+    // new ops until its blocks are copied.
+    log.clh = log.lh;
     log.lh.n = 0;
-    write_head();  // Erase the transaction from the log
+    seq = log.seq++;
+    log.want = 0;
+    log.copying = 1;
+    release(&log.lock);
+
+    copy_log();
+
+    acquire(&log.lock);
+    log.copying = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    write_log();  // Write copied blocks to log
+    append_trans();
+    write_head();  // Write header to disk -- the real commit
+    log.st.commits++;
+    log.st.logged += log.clh.n;
+
+    acquire(&log.lock);
+    log.done = seq;
   }
+  // nothing is left to commit, so nothing is wanted.
+  if (log.lh.n == 0) log.want = 0;
+  log.committing = 0;
+  wakeup(&log);
+}
+
+// Report the log's counters.
+void logstat(struct logstat *st) {
+  acquire(&log.lock);
+  *st = log.st;
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -194,7 +445,7 @@ void log_write(struct buf *b) {
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1) panic("too big a transaction");
+  if (log.lh.n >= log.cap) panic("too big a transaction");
   if (log.outstanding < 1) panic("log_write outside of trans");
 
   for (i = 0; i < log.lh.n; i++) {
@@ -203,6 +454,10 @@ void log_write(struct buf *b) {
   }
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
+    if (log.lh.n == 0) {
+      log.opened = r_time();
+      wakeup(&log.opened);  // for logflusher()
+    }
     bpin(b);
     log.lh.n++;
   }
@@ -15,9 +15,12 @@ void main() {
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();             // physical page allocator
+    slabinit();          // small-object caches
+    if (MEMBENCH) membench();
     kvminit();           // create kernel page table
     kvminithart();       // turn on paging
     procinit();          // process table
+    tminit();            // sleep timers
     trapinit();          // trap vectors
     trapinithart();      // install kernel trap vector
     plicinit();          // set up interrupt controller
@@ -25,6 +28,7 @@ void main() {
     binit();             // buffer cache
     iinit();             // inode table
     fileinit();          // file table
+    pipeinit();          // pipe cache
     virtio_disk_init();  // emulated hard disk
     userinit();          // first user process
     __sync_synchronize();
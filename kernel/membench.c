@@ -0,0 +1,88 @@
+// Boot-time microbenchmark of the string.c routines, run
+// when MEMBENCH is set in param.h. Each is timed against the
+// plain byte loop it replaced, on page-sized and small
+// buffers, aligned and not, and reported in bytes per
+// hundred cycles.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NREP 64
+
+static void *bytemove(void *dst, const void *src, uint n) {
+  const char *s = src;
+  char *d = dst;
+
+  if (s < d && s + n > d) {
+    s += n;
+    d += n;
+    while (n-- > 0) *--d = *--s;
+  } else
+    while (n-- > 0) *d++ = *s++;
+  return dst;
+}
+
+static void *byteset(void *dst, int c, uint n) {
+  char *d = dst;
+
+  while (n-- > 0) *d++ = c;
+  return dst;
+}
+
+static int bytecmp(const void *v1, const void *v2, uint n) {
+  const uchar *s1 = v1, *s2 = v2;
+
+  while (n-- > 0) {
+    if (*s1 != *s2) return *s1 - *s2;
+    s1++, s2++;
+  }
+  return 0;
+}
+
+// Bytes per hundred cycles for NREP calls of op on a
+// and b, at offsets oa and ob, n bytes each.
+static uint64 rate(int op, char *a, char *b, int oa, int ob, uint n) {
+  volatile int sink = 0;
+  uint64 t0, t1;
+  int i;
+
+  t0 = r_cycle();
+  for (i = 0; i < NREP; i++) {
+    switch (op) {
+      case 0: bytemove(a + oa, b + ob, n); break;
+      case 1: memmove(a + oa, b + ob, n); break;
+      case 2: byteset(a + oa, i, n); break;
+      case 3: memset(a + oa, i, n); break;
+      case 4: sink += bytecmp(a + oa, b + ob, n); break;
+      case 5: sink += memcmp(a + oa, b + ob, n); break;
+    }
+  }
+  t1 = r_cycle();
+  return (uint64)NREP * n * 100 / (t1 - t0 + 1);
+}
+
+void membench(void) {
+  static char *names[] = {"memmove", "memset", "memcmp"};
+  static struct {
+    int oa, ob;
+    uint n;
+  } cases[] = {{0, 0, PGSIZE}, {3, 5, PGSIZE - 8}, {0, 0, 64}, {1, 2, 61}};
+  char *a, *b;
+  int op, i;
+
+  if ((a = kalloc()) == 0 || (b = kalloc()) == 0) panic("membench");
+  memset(b, 7, PGSIZE);
+  printf("membench: bytes/100 cycles, byte loop -> word loop\n");
+  for (op = 0; op < 3; op++) {
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+      memmove(a, b, PGSIZE);  // equal, so memcmp reads all n
+      printf("membench: %s %d bytes at +%d/+%d: %lu -> %lu\n", names[op], cases[i].n, cases[i].oa, cases[i].ob,
+             rate(2 * op, a, b, cases[i].oa, cases[i].ob, cases[i].n), rate(2 * op + 1, a, b, cases[i].oa, cases[i].ob, cases[i].n));
+    }
+  }
+  kfree(a);
+  kfree(b);
+}
@@ -0,0 +1,268 @@
+//
+// Memory-mapped files.
+//
+// Each process has a table of NVMA regions (struct vma in proc.h),
+// placed top-down below TRAPFRAME. mmap() only records a region;
+// vmafault() fills each page from the file when it is first touched.
+// Unmapping a MAP_SHARED region writes its dirty pages back to the
+// file, through the log.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "proc.h"
+#include "fcntl.h"
+
+// Return p's region containing va, or 0.
+static struct vma *vmalookup(struct proc *p, uint64 va) {
+  struct vma *v;
+
+  for (v = p->vma; v < &p->vma[NVMA]; v++) {
+    if (v->len > 0 && va >= v->addr && va < v->addr + v->len) return v;
+  }
+  return 0;
+}
+
+// Return the lowest address of any of p's mappings.
+// The heap must not grow past it.
+uint64 vmalow(struct proc *p) {
+  struct vma *v;
+  uint64 low = TRAPFRAME;
+
+  for (v = p->vma; v < &p->vma[NVMA]; v++) {
+    if (v->len > 0 && v->addr < low) low = v->addr;
+  }
+  return low;
+}
+
+// Is [addr, addr+len) above the heap, below TRAPFRAME
+// and clear of p's other mappings?
+static int vmafits(struct proc *p, uint64 addr, uint64 len) {
+  struct vma *v;
+
+  if (addr < PGROUNDUP(p->sz) || addr + len < addr || addr + len > TRAPFRAME) return 0;
+  for (v = p->vma; v < &p->vma[NVMA]; v++) {
+    if (v->len > 0 && addr < v->addr + v->len && v->addr < addr + len) return 0;
+  }
+  return 1;
+}
+
+// Pick an address for a new len-byte mapping: the highest
+// free gap, trying just below TRAPFRAME and just below
+// each existing mapping. Returns 0 if there is no room.
+static uint64 vmaplace(struct proc *p, uint64 len) {
+  struct vma *v;
+  uint64 best = 0;
+
+  if (len <= TRAPFRAME && vmafits(p, TRAPFRAME - len, len)) best = TRAPFRAME - len;
+  for (v = p->vma; v < &p->vma[NVMA]; v++) {
+    if (v->len == 0 || v->addr < len) continue;
+    if (v->addr - len > best && vmafits(p, v->addr - len, len)) best = v->addr - len;
+  }
+  return best;
+}
+
+// Map len bytes of file f, starting at offset off, into the
+// current process. addr is a hint, used if it is page-aligned
+// and free. Returns the start address, or -1.
+uint64 mmap(uint64 addr, uint64 len, int prot, int flags, struct file *f, uint off) {
+  struct proc *p = myproc();
+  struct vma *v, *fv;
+
+  if (len == 0 || (off % PGSIZE) != 0) return -1;
+  if (flags != MAP_SHARED && flags != MAP_PRIVATE) return -1;
+  if (f->type != FD_INODE || !f->readable) return -1;
+  if ((prot & PROT_WRITE) && flags == MAP_SHARED && !f->writable) return -1;
+  if (len > TRAPFRAME) return -1;
+  len = PGROUNDUP(len);
+
+  fv = 0;
+  for (v = p->vma; v < &p->vma[NVMA]; v++) {
+    if (v->len == 0) {
+      fv = v;
+      break;
+    }
+  }
+  if (fv == 0) return -1;
+
+  if (addr == 0 || (addr % PGSIZE) != 0 || !vmafits(p, addr, len)) addr = vmaplace(p, len);
+  if (addr == 0) return -1;
+
+  fv->addr = addr;
+  fv->len = len;
+  fv->prot = prot;
+  fv->flags = flags;
+  fv->off = off;
+  fv->f = filedup(f);
+  return addr;
+}
+
+// Handle a page fault at va, of the kind given by scause, in
+// one of p's mappings: read the page in from the file.
+// Returns 0 on success, -1 if va is not in a mapping that
+// allows the access, or there is no memory.
+int vmafault(struct proc *p, uint64 va, uint64 scause) {
+  struct vma *v;
+  struct inode *ip;
+  pte_t *pte;
+  char *mem;
+  int n, perm;
+
+  if ((v = vmalookup(p, va)) == 0) return -1;
+  if (scause == 12 && (v->prot & PROT_EXEC) == 0) return -1;
+  if (scause == 13 && (v->prot & PROT_READ) == 0) return -1;
+  if (scause == 15 && (v->prot & PROT_WRITE) == 0) return -1;
+
+  va = PGROUNDDOWN(va);
+  if ((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V)) return -1;
+
+  if ((mem = kalloc_zeroed()) == 0) return -1;
+
+  ip = v->f->ip;
+  ilock(ip);
+  n = readi(ip, 0, (uint64)mem, v->off + (va - v->addr), PGSIZE);
+  iunlock(ip);
+  if (n < 0) {
+    kfree(mem);
+    return -1;
+  }
+
+  perm = PTE_U;
+  if (v->prot & PROT_READ) perm |= PTE_R;
+  if (v->prot & PROT_WRITE) perm |= PTE_R | PTE_W;
+  if (v->prot & PROT_EXEC) perm |= PTE_X;
+  if (mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0) {
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Fault in the pages of p's mappings in [va, va+n) that are not
+// there yet, before a system call copies to or from them.
+// copyin() and copyout() do not read file pages in themselves:
+// their callers may hold a spinlock, such as a pipe's, or the
+// lock of another inode.
+void vmaprefault(struct proc *p, uint64 va, uint64 n, int write) {
+  struct vma *v;
+  uint64 a, lo, hi;
+  pte_t *pte;
+
+  for (v = p->vma; v < &p->vma[NVMA]; v++) {
+    if (v->len == 0 || va >= v->addr + v->len || va + n <= v->addr) continue;
+    lo = va > v->addr ? PGROUNDDOWN(va) : v->addr;
+    hi = va + n < v->addr + v->len ? va + n : v->addr + v->len;
+    for (a = lo; a < hi; a += PGSIZE) {
+      if ((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & PTE_V)) continue;
+      // on failure the copy fails too, and the call returns -1.
+      if (vmafault(p, a, write ? 15 : 13) != 0) break;
+    }
+  }
+}
+
+// Write the dirty pages of v in [addr, addr+len) back to
+// v's file. Never extends the file.
+static void vmawriteback(struct proc *p, struct vma *v, uint64 addr, uint64 len) {
+  struct inode *ip = v->f->ip;
+  uint64 va;
+  uint off, n;
+  pte_t *pte;
+
+  for (va = addr; va < addr + len; va += PGSIZE) {
+    pte = walk(p->pagetable, va, 0);
+    if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D) == 0) continue;
+    off = v->off + (va - v->addr);
+
+    // a page is at most 4 data blocks plus the inode and
+    // indirect blocks, well within MAXOPBLOCKS.
+    begin_op();
+    ilock(ip);
+    if (off < ip->size) {
+      n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+      writei(ip, 0, PTE2PA(*pte), off, n);
+    }
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Remove [addr, addr+len) from v, which must be at one
+// end of v, writing back shared pages first.
+static void vmaunmap(struct proc *p, struct vma *v, uint64 addr, uint64 len) {
+  struct file *f;
+
+  if (v->flags == MAP_SHARED) vmawriteback(p, v, addr, len);
+  uvmunmap(p->pagetable, addr, len / PGSIZE, 1);
+
+  if (addr == v->addr) {
+    v->addr += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if (v->len == 0) {
+    f = v->f;
+    v->addr = 0;
+    v->f = 0;
+    fileclose(f);
+  }
+}
+
+// Unmap [addr, addr+len) from the current process.
+// The range must lie within one mapping and include its
+// start or its end; punching holes is not supported.
+// Returns 0 on success, -1 on error.
+int munmap(uint64 addr, uint64 len) {
+  struct proc *p = myproc();
+  struct vma *v;
+
+  if ((addr % PGSIZE) != 0 || len == 0) return -1;
+  len = PGROUNDUP(len);
+  if ((v = vmalookup(p, addr)) == 0) return -1;
+  if (addr + len < addr || addr + len > v->addr + v->len) return -1;
+  if (addr != v->addr && addr + len != v->addr + v->len) return -1;
+  vmaunmap(p, v, addr, len);
+  return 0;
+}
+
+// Unmap all of p's mappings, for exit() and exec().
+void vmafree(struct proc *p) {
+  struct vma *v;
+
+  for (v = p->vma; v < &p->vma[NVMA]; v++) {
+    if (v->len > 0) vmaunmap(p, v, v->addr, v->len);
+  }
+}
+
+// Give the new child np the same mappings as p. Pages that
+// are present are shared: copy-on-write for MAP_PRIVATE,
+// directly for MAP_SHARED.
+// Returns 0 on success, -1 on failure. Does not sleep,
+// since fork() holds np->lock.
+int vmacopy(struct proc *p, struct proc *np) {
+  struct vma *v;
+  int i, j;
+
+  for (i = 0; i < NVMA; i++) {
+    v = &p->vma[i];
+    if (v->len == 0) continue;
+    if (uvmshare(p->pagetable, np->pagetable, v->addr, v->len, v->flags == MAP_PRIVATE) < 0) {
+      for (j = 0; j < i; j++) {
+        if (p->vma[j].len > 0) uvmunmap(np->pagetable, p->vma[j].addr, p->vma[j].len / PGSIZE, 1);
+      }
+      return -1;
+    }
+  }
+
+  for (i = 0; i < NVMA; i++) {
+    np->vma[i] = p->vma[i];
+    if (np->vma[i].len > 0) filedup(np->vma[i].f);
+  }
+  return 0;
+}
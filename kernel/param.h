@@ -1,14 +1,27 @@
-#define NPROC 64                   // maximum number of processes
-#define NCPU 8                     // maximum number of CPUs
-#define NOFILE 16                  // open files per process
-#define NFILE 100                  // open files per system
-#define NINODE 50                  // maximum number of active i-nodes
-#define NDEV 10                    // maximum major device number
-#define ROOTDEV 1                  // device number of file system root disk
-#define MAXARG 32                  // max exec arguments
-#define MAXOPBLOCKS 10             // max # of blocks any FS op writes
-#define LOGSIZE (MAXOPBLOCKS * 3)  // max data blocks in on-disk log
-#define NBUF (MAXOPBLOCKS * 3)     // size of disk block cache
-#define FSSIZE 2000                // size of file system in blocks
-#define MAXPATH 128                // maximum file path name
-#define USERSTACK 1                // user stack pages
+#define NPROC 64                              // maximum number of processes
+#define NCPU 8                                // maximum number of CPUs
+#define NOFILE 16                             // open files per process
+#define NFILE 100                             // open files per system
+#define NINODE 50                             // maximum number of active i-nodes
+#define NDEV 10                               // maximum major device number
+#define ROOTDEV 1                             // device number of file system root disk
+#define MAXARG 32                             // max exec arguments
+#define MAXOPBLOCKS 32                        // max # of blocks any FS op writes; see fsinit()
+#define LOGSIZE (MAXOPBLOCKS * 10)            // max data blocks in on-disk log
+#define NBUF (LOGSIZE * 3 + MAXOPBLOCKS * 9)  // size of disk block cache
+#define NBULK 8                               // max blocks in one disk request
+#define FSSIZE 200000                         // size of file system in blocks
+#define MAXPATH 128                           // maximum file path name
+#define USERSTACK 1                           // user stack pages
+#define NVMA 16                               // memory-mapped regions per process
+#define COMMITTICKS 10                        // max ticks before a log commit; 0: commit in end_op()
+#define NPRIO 4                               // scheduler priority levels
+#define BOOSTTICKS 50                         // ticks between priority boosts
+#define TIMEBASE 10000000                     // time CSR cycles per second
+#define TICKCYCLES (TIMEBASE / 10)            // cycles per scheduling tick
+#define IDLETICKS 10                          // max ticks between timer interrupts when all CPUs idle
+#define MINQUANTUM 100                        // shortest base quantum setquantum() allows, microseconds
+#define MAXQUANTUM 1000000                    // longest base quantum setquantum() allows, microseconds
+#define NCACHE 8                              // slab caches
+#define MAXORDER 10                           // largest kalloc_pages() block is 2^MAXORDER pages
+#define MEMBENCH 0                            // 1: time memmove/memset/memcmp at boot
@@ -8,29 +8,66 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// The ring buffer is PIPEPAGES whole pages, so that reads
+// and writes copy page-sized spans to and from user memory.
+#define PIPEPAGES 4
+#define PIPESIZE (PIPEPAGES * PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
-  uint nread;     // number of bytes read
-  uint nwrite;    // number of bytes written
-  int readopen;   // read fd is still open
-  int writeopen;  // write fd is still open
+  char *data[PIPEPAGES];  // the ring, PGSIZE bytes per page
+  uint nread;             // number of bytes read
+  uint nwrite;            // number of bytes written
+  int readopen;           // read fd is still open
+  int writeopen;          // write fd is still open
+  int rwait;              // readers asleep on nread
+  int wwait;              // writers asleep on nwrite
 };
 
+// The contiguous span of the ring starting at byte off,
+// which ends at the page's end or after max bytes.
+static char *pipespan(struct pipe *pi, uint off, uint *max) {
+  uint n = PGSIZE - off % PGSIZE;
+
+  if (*max > n) *max = n;
+  return pi->data[off / PGSIZE % PIPEPAGES] + off % PGSIZE;
+}
+
+// struct pipes come from a slab cache rather than a page each.
+static struct kmem_cache *pipecache;
+
+// Constructor for pipecache's objects.
+static void pipector(void *p) { initlock(&((struct pipe *)p)->lock, "pipe"); }
+
+void pipeinit(void) {
+  if ((pipecache = kmem_cache_create("pipe", sizeof(struct pipe), pipector)) == 0) panic("pipeinit");
+}
+
+static void pipefree(struct pipe *pi) {
+  int i;
+
+  for (i = 0; i < PIPEPAGES; i++)
+    if (pi->data[i]) kfree(pi->data[i]);
+  kmem_cache_free(pipecache, pi);
+}
+
 int pipealloc(struct file **f0, struct file **f1) {
   struct pipe *pi;
+  int i;
 
   pi = 0;
   *f0 = *f1 = 0;
   if ((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0) goto bad;
-  if ((pi = (struct pipe *)kalloc()) == 0) goto bad;
+  if ((pi = kmem_cache_alloc(pipecache)) == 0) goto bad;
+  memset(pi->data, 0, sizeof(pi->data));
+  for (i = 0; i < PIPEPAGES; i++)
+    if ((pi->data[i] = kalloc()) == 0) goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
-  initlock(&pi->lock, "pipe");
+  pi->rwait = 0;
+  pi->wwait = 0;
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -42,7 +79,7 @@ int pipealloc(struct file **f0, struct file **f1) {
   return 0;
 
 bad:
-  if (pi) kfree((char *)pi);
+  if (pi) pipefree(pi);
   if (*f0) fileclose(*f0);
   if (*f1) fileclose(*f1);
   return -1;
@@ -59,13 +96,36 @@ void pipeclose(struct pipe *pi, int writable) {
   }
   if (pi->readopen == 0 && pi->writeopen == 0) {
     release(&pi->lock);
-    kfree((char *)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
-int pipewrite(struct pipe *pi, uint64 addr, int n) {
-  int i = 0;
+// Copy up to n bytes into the ring a span at a time, as many
+// as fit without waiting. Return how many, or -1 if a copy
+// fails before any. Caller holds pi->lock.
+static int pipeput1(struct pipe *pi, int user_src, uint64 addr, int n) {
+  int i;
+  uint m;
+  char *dst;
+
+  for (i = 0; i < n && pi->nwrite != pi->nread + PIPESIZE; i += m) {
+    m = n - i;
+    if (m > pi->nread + PIPESIZE - pi->nwrite) m = pi->nread + PIPESIZE - pi->nwrite;
+    dst = pipespan(pi, pi->nwrite, &m);
+    if (either_copyin(dst, user_src, addr + i, m) == -1) return i > 0 ? i : -1;
+    pi->nwrite += m;
+  }
+  return i;
+}
+
+// Write n bytes from addr, waiting for room as needed.
+// Readers are woken only if some are asleep, and then
+// only once the ring fills or the write is done.
+// If user_src==1, then addr is a user virtual address;
+// otherwise, addr is a kernel address.
+int pipewrite(struct pipe *pi, int user_src, uint64 addr, int n) {
+  int i = 0, m;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -75,25 +135,62 @@ int pipewrite(struct pipe *pi, uint64 addr, int n) {
       return -1;
     }
     if (pi->nwrite == pi->nread + PIPESIZE) {  // DOC: pipewrite-full
-      wakeup(&pi->nread);
+      if (pi->rwait) wakeup(&pi->nread);
+      pi->wwait++;
       sleep(&pi->nwrite, &pi->lock);
+      pi->wwait--;
     } else {
-      char ch;
-      if (copyin(pr->pagetable, &ch, addr + i, 1) == -1) break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      if ((m = pipeput1(pi, user_src, addr + i, n - i)) < 0) break;
+      i += m;
     }
   }
-  wakeup(&pi->nread);
+  if (pi->rwait) wakeup(&pi->nread);
   release(&pi->lock);
 
   return i;
 }
 
-int piperead(struct pipe *pi, uint64 addr, int n) {
+// Wait until pi has room, and return how much. Return -1
+// if the read end is closed or the process is killed.
+int piperoom(struct pipe *pi) {
+  struct proc *pr = myproc();
+  int n;
+
+  acquire(&pi->lock);
+  while (pi->nwrite == pi->nread + PIPESIZE) {
+    if (pi->readopen == 0 || killed(pr)) break;
+    pi->wwait++;
+    sleep(&pi->nwrite, &pi->lock);
+    pi->wwait--;
+  }
+  n = pi->readopen == 0 || killed(pr) ? -1 : pi->nread + PIPESIZE - pi->nwrite;
+  release(&pi->lock);
+  return n;
+}
+
+// Copy as much of the n bytes at kernel address src as
+// fits into pi without waiting, for a caller that must not
+// sleep here. Return how many, or -1 if the read end is closed.
+int pipeput(struct pipe *pi, char *src, int n) {
+  int r = -1;
+
+  acquire(&pi->lock);
+  if (pi->readopen) {
+    r = pipeput1(pi, 0, (uint64)src, n);
+    if (pi->rwait) wakeup(&pi->nread);
+  }
+  release(&pi->lock);
+  return r;
+}
+
+// Copy from the ring a span at a time.
+// If user_dst==1, then addr is a user virtual address;
+// otherwise, addr is a kernel address.
+int piperead(struct pipe *pi, int user_dst, uint64 addr, int n) {
   int i;
+  uint m;
+  char *src;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while (pi->nread == pi->nwrite && pi->writeopen) {  // DOC: pipe-empty
@@ -101,14 +198,18 @@ int piperead(struct pipe *pi, uint64 addr, int n) {
       release(&pi->lock);
       return -1;
     }
+    pi->rwait++;
     sleep(&pi->nread, &pi->lock);  // DOC: piperead-sleep
+    pi->rwait--;
   }
-  for (i = 0; i < n; i++) {  // DOC: piperead-copy
-    if (pi->nread == pi->nwrite) break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if (copyout(pr->pagetable, addr + i, &ch, 1) == -1) break;
+  for (i = 0; i < n && pi->nread != pi->nwrite; i += m) {  // DOC: piperead-copy
+    m = n - i;
+    if (m > pi->nwrite - pi->nread) m = pi->nwrite - pi->nread;
+    src = pipespan(pi, pi->nread, &m);
+    if (either_copyout(user_dst, addr + i, src, m) == -1) break;
+    pi->nread += m;
   }
-  wakeup(&pi->nwrite);  // DOC: piperead-wakeup
+  if (pi->wwait) wakeup(&pi->nwrite);  // DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "kstat.h"
 
 struct cpu cpus[NCPU];
 
@@ -12,11 +13,49 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// Multilevel feedback queue: each CPU has one FIFO run
+// queue of RUNNABLE processes per priority level. A process
+// at level i runs for QUANTUM(i) ticks, each p->quantum
+// cycles long (TICKCYCLES unless changed with setquantum()
+// to trade latency for throughput); if it uses them all
+// it moves down a level, and if it sleeps before using
+// half of them it moves up one when it wakes. Every
+// BOOSTTICKS, prioboost() moves everyone to level 0, so
+// that CPU-bound processes do not starve.
+//
+// A process is queued on the CPU it last ran on, whose
+// caches may still hold its memory. A CPU whose queues
+// are empty steals from the CPU with the most waiting.
+#define QUANTUM(prio) (1 << (prio))
+
+uint boostgen;  // number of priority boosts so far
+
+// Run queue latency of each process, under its p->lock,
+// and of all processes run on each CPU, written only by
+// that CPU.
+struct schedlat plat[NPROC];
+struct schedlat clat[NCPU];
+
+// Sleeping processes, hashed by channel into wait queues,
+// so that wakeup() looks only at processes that may be
+// sleeping on its channel. Lock order: the lock passed to
+// sleep(), then a wait queue's lock, then p->lock.
+#define NWAITQ 61
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;  // processes in sleep() on channels hashed here
+} waitq[NWAITQ];
+
+static struct waitq *whash(void *chan) { return &waitq[(uint64)chan % NWAITQ]; }
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
+static void setrunnable(struct proc *p);
 
 extern char trampoline[];  // trampoline.S
 
@@ -43,9 +82,13 @@ void proc_mapstacks(pagetable_t kpgtbl) {
 // initialize the proc table.
 void procinit(void) {
   struct proc *p;
+  struct cpu *c;
+  struct waitq *wq;
 
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for (c = cpus; c < &cpus[NCPU]; c++) initlock(&c->rqlock, "runq");
+  for (wq = waitq; wq < &waitq[NWAITQ]; wq++) initlock(&wq->lock, "waitq");
   for (p = proc; p < &proc[NPROC]; p++) {
     initlock(&p->lock, "proc");
     p->state = UNUSED;
@@ -109,6 +152,10 @@ static struct proc *allocproc(void) {
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->boost = boostgen;
+  p->cpu = cpuid();
+  p->quantum = TICKCYCLES;
+  memset(&plat[p - proc], 0, sizeof(plat[0]));
 
   // Allocate a trapframe page.
   if ((p->trapframe = (struct trapframe *)kalloc()) == 0) {
@@ -146,9 +193,11 @@ static void freeproc(struct proc *p) {
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
-  p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->prio = 0;
+  p->slice = 0;
+  p->kfn = 0;
   p->state = UNUSED;
 }
 
@@ -215,12 +264,28 @@ void userinit(void) {
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
+
+  release(&p->lock);
+}
+
+// Start a kernel thread running fn(), which must not return.
+// It is a process that never enters user space.
+void kthread(void (*fn)(void), char *name) {
+  struct proc *p;
+
+  if ((p = allocproc()) == 0) panic("kthread");
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  setrunnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only moves p->sz; usertrap() allocates
+// each page when it is first touched.
 // Return 0 on success, -1 on failure.
 int growproc(int n) {
   uint64 sz;
@@ -228,9 +293,8 @@ int growproc(int n) {
 
   sz = p->sz;
   if (n > 0) {
-    if ((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
-      return -1;
-    }
+    if (sz + n > vmalow(p)) return -1;
+    sz += n;
   } else if (n < 0) {
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -258,6 +322,13 @@ int fork(void) {
   }
   np->sz = p->sz;
 
+  // Share memory-mapped files.
+  if (vmacopy(p, np) < 0) {
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
@@ -280,7 +351,9 @@ int fork(void) {
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  np->prio = p->prio;
+  np->quantum = p->quantum;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
@@ -307,6 +380,9 @@ void exit(int status) {
 
   if (p == initproc) panic("init exiting");
 
+  // Unmap memory-mapped files, writing back shared ones.
+  vmafree(p);
+
   // Close all open files.
   for (int fd = 0; fd < NOFILE; fd++) {
     if (p->ofile[fd]) {
@@ -387,6 +463,119 @@ int wait(uint64 addr) {
   }
 }
 
+// If a priority boost happened since p last looked,
+// move p to the top level. Caller holds p->lock.
+static void checkboost(struct proc *p) {
+  uint gen = __atomic_load_n(&boostgen, __ATOMIC_SEQ_CST);
+
+  if (p->boost != gen) {
+    p->boost = gen;
+    p->prio = 0;
+    p->slice = 0;
+  }
+}
+
+// Mark p RUNNABLE and queue it at its priority level,
+// on the CPU it last ran on. Caller holds p->lock.
+static void setrunnable(struct proc *p) {
+  struct cpu *c = &cpus[p->cpu];
+
+  checkboost(p);
+  p->state = RUNNABLE;
+  p->readyat = r_time();
+
+  acquire(&c->rqlock);
+  p->rqnext = 0;
+  if (c->rqtail[p->prio])
+    c->rqtail[p->prio]->rqnext = p;
+  else
+    c->rqhead[p->prio] = p;
+  c->rqtail[p->prio] = p;
+  c->nready[p->prio]++;
+  release(&c->rqlock);
+}
+
+// Add a wait of the given number of cycles to l.
+static void latrecord(struct schedlat *l, uint64 cycles) {
+  uint64 us = cycles / (TIMEBASE / 1000000);
+  int i;
+
+  for (i = 0; i < NLATBUCKET - 1 && us >= (2UL << i); i++);
+  l->hist[i]++;
+  l->n++;
+  l->total += us;
+  if (us > l->max) l->max = us;
+}
+
+// Take the first process off c's highest nonempty
+// run queue, or return 0 if they are all empty.
+static struct proc *runqget(struct cpu *c) {
+  struct proc *p;
+  int i;
+
+  acquire(&c->rqlock);
+  for (i = 0; i < NPRIO; i++) {
+    if ((p = c->rqhead[i]) != 0) {
+      c->rqhead[i] = p->rqnext;
+      if (c->rqhead[i] == 0) c->rqtail[i] = 0;
+      c->nready[i]--;
+      release(&c->rqlock);
+      return p;
+    }
+  }
+  release(&c->rqlock);
+  return 0;
+}
+
+// How many processes wait in c's run queues?
+// Without the lock, so only a hint.
+static int nready(struct cpu *c) {
+  int i, n = 0;
+
+  for (i = 0; i < NPRIO; i++) n += __atomic_load_n(&c->nready[i], __ATOMIC_RELAXED);
+  return n;
+}
+
+// For idle CPU c, take a process from the CPU with the
+// most processes waiting, or return 0 if none is.
+static struct proc *steal(struct cpu *c) {
+  struct cpu *v, *busiest = 0;
+  int n, most = 0;
+
+  for (v = cpus; v < &cpus[NCPU]; v++) {
+    if (v != c && (n = nready(v)) > most) {
+      most = n;
+      busiest = v;
+    }
+  }
+  return busiest ? runqget(busiest) : 0;
+}
+
+// Move every process to the top level. Queued processes
+// move now; the others, and the prio fields of the queued
+// ones, catch up in checkboost().
+void prioboost(void) {
+  struct cpu *c;
+  int i;
+
+  __atomic_fetch_add(&boostgen, 1, __ATOMIC_SEQ_CST);
+  for (c = cpus; c < &cpus[NCPU]; c++) {
+    acquire(&c->rqlock);
+    for (i = 1; i < NPRIO; i++) {
+      if (c->rqhead[i] == 0) continue;
+      if (c->rqtail[0])
+        c->rqtail[0]->rqnext = c->rqhead[i];
+      else
+        c->rqhead[0] = c->rqhead[i];
+      c->rqtail[0] = c->rqtail[i];
+      c->nready[0] += c->nready[i];
+      c->rqhead[i] = c->rqtail[i] = 0;
+      c->nready[i] = 0;
+    }
+    release(&c->rqlock);
+  }
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -397,6 +586,7 @@ int wait(uint64 addr) {
 void scheduler(void) {
   struct proc *p;
   struct cpu *c = mycpu();
+  uint64 now;
 
   c->proc = 0;
   for (;;) {
@@ -405,29 +595,44 @@ void scheduler(void) {
     // processes are waiting.
     intr_on();
 
-    int found = 0;
-    for (p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if (p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        found = 1;
-      }
-      release(&p->lock);
-    }
-    if (found == 0) {
-      // nothing to run; stop running on this core until an interrupt.
-      intr_on();
+    if ((p = runqget(c)) == 0 && (p = steal(c)) != 0) c->ssteals++;
+    // idle time goes first to zeroing pages for kalloc_zeroed().
+    if (p == 0 && kzerofill()) continue;
+    if (p == 0) {
+      // nothing to run; stop running on this core until an interrupt,
+      // with the timer set for the next thing this core has to do.
+      // wfi returns once an interrupt is pending, even with them
+      // off, so one that arrives before the wfi is not missed; the
+      // intr_on() at the top of the loop then takes it.
+      intr_off();
+      tmarm();
       asm volatile("wfi");
+      continue;
     }
+
+    acquire(&p->lock);
+    if (p->state != RUNNABLE) panic("scheduler");
+    checkboost(p);
+    p->cpu = c - cpus;
+    c->sruns++;
+    now = r_time();
+    latrecord(&plat[p - proc], now - p->readyat);
+    latrecord(&clat[c - cpus], now - p->readyat);
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    c->proc = p;
+    c->quantum = p->quantum;
+    c->tickat = now + p->quantum;
+    c->tickdue = 0;
+    tmarm();
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -456,11 +661,39 @@ void sched(void) {
 void yield(void) {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
 
+// Called on a timer interrupt by the process it interrupted.
+// If the interrupt ended a tick, charge it to the process;
+// if that uses up its quantum, move it down a level. Give
+// up the CPU then, or if a process at a higher level is
+// waiting, perhaps woken by this interrupt.
+void proctick(void) {
+  struct proc *p = myproc();
+  struct cpu *c = mycpu();
+  int i, preempt = 0;
+
+  acquire(&p->lock);
+  checkboost(p);
+  if (c->tickdue) {
+    c->tickdue = 0;
+    if (++p->slice >= QUANTUM(p->prio)) {
+      if (p->prio < NPRIO - 1) p->prio++;
+      p->slice = 0;
+      preempt = 1;
+    }
+  }
+  for (i = 0; i < p->prio; i++) {
+    if (__atomic_load_n(&c->nready[i], __ATOMIC_RELAXED) > 0) preempt = 1;
+  }
+  release(&p->lock);
+
+  if (preempt) yield();
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void forkret(void) {
@@ -483,49 +716,83 @@ void forkret(void) {
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void kthreadret(void) {
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  myproc()->kfn();
+  panic("kthreadret");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void sleep(void *chan, struct spinlock *lk) {
   struct proc *p = myproc();
+  struct waitq *wq = whash(chan);
+  struct proc **pp;
 
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold wq->lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks wq->lock),
   // so it's okay to release lk.
 
-  acquire(&p->lock);  // DOC: sleeplock1
+  acquire(&wq->lock);  // DOC: sleeplock1
+  acquire(&p->lock);
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
+  p->wqnext = wq->head;
+  wq->head = p;
   p->state = SLEEPING;
+  release(&wq->lock);
 
   sched();
 
-  // Tidy up.
+  // Tidy up. wakeup() and kill() leave p on the wait queue.
+  release(&p->lock);
+  acquire(&wq->lock);
+  for (pp = &wq->head; *pp != p; pp = &(*pp)->wqnext);
+  *pp = p->wqnext;
   p->chan = 0;
+  release(&wq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
+// Make sleeping p RUNNABLE. A process that sleeps before
+// using half of its quantum looks I/O-bound, so it moves up
+// a level. Caller holds p->lock.
+static void wakeproc(struct proc *p) {
+  if (p->prio > 0 && p->slice < QUANTUM(p->prio) / 2) {
+    p->prio--;
+    p->slice = 0;
+  }
+  setrunnable(p);
+}
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void wakeup(void *chan) {
+  struct waitq *wq = whash(chan);
   struct proc *p;
 
-  for (p = proc; p < &proc[NPROC]; p++) {
-    if (p != myproc()) {
+  acquire(&wq->lock);
+  for (p = wq->head; p; p = p->wqnext) {
+    if (p->chan == chan) {
       acquire(&p->lock);
-      if (p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
+      // p may have been woken already and not yet
+      // left the queue.
+      if (p->state == SLEEPING) wakeproc(p);
       release(&p->lock);
     }
   }
+  release(&wq->lock);
 }
 
 // Kill the process with the given pid.
@@ -540,7 +807,7 @@ int kill(int pid) {
       p->killed = 1;
       if (p->state == SLEEPING) {
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        wakeproc(p);
       }
       release(&p->lock);
       return 0;
@@ -550,6 +817,130 @@ int kill(int pid) {
   return -1;
 }
 
+// Set the scheduling level of the process with the given
+// pid, and start it on a fresh quantum there. A RUNNABLE
+// process moves to its new level's queue the next time
+// it is queued.
+int setpriority(int pid, int prio) {
+  struct proc *p;
+
+  if (prio < 0 || prio >= NPRIO) return -1;
+  for (p = proc; p < &proc[NPROC]; p++) {
+    acquire(&p->lock);
+    if (p->pid == pid && p->state != UNUSED) {
+      checkboost(p);
+      p->prio = prio;
+      p->slice = 0;
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Return the scheduling level of the process with the
+// given pid, or -1 if there is none.
+int getpriority(int pid) {
+  struct proc *p;
+  int prio;
+
+  for (p = proc; p < &proc[NPROC]; p++) {
+    acquire(&p->lock);
+    if (p->pid == pid && p->state != UNUSED) {
+      checkboost(p);
+      prio = p->prio;
+      release(&p->lock);
+      return prio;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Set the length of the ticks of the process with the given
+// pid to us microseconds, and start it on a fresh quantum. A
+// running process gets the new length when next scheduled.
+int setquantum(int pid, int us) {
+  struct proc *p;
+
+  if (us < MINQUANTUM || us > MAXQUANTUM) return -1;
+  for (p = proc; p < &proc[NPROC]; p++) {
+    acquire(&p->lock);
+    if (p->pid == pid && p->state != UNUSED) {
+      p->quantum = (uint64)us * (TIMEBASE / 1000000);
+      p->slice = 0;
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Return the tick length, in microseconds, of the process
+// with the given pid, or -1 if there is none.
+int getquantum(int pid) {
+  struct proc *p;
+  int us;
+
+  for (p = proc; p < &proc[NPROC]; p++) {
+    acquire(&p->lock);
+    if (p->pid == pid && p->state != UNUSED) {
+      us = p->quantum / (TIMEBASE / 1000000);
+      release(&p->lock);
+      return us;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Report the run queue latency of the process with the
+// given pid, or if pid is 0 of every process run since
+// boot. Return -1 if there is no such process.
+int schedlat(int pid, struct schedlat *st) {
+  struct proc *p;
+  struct schedlat *c;
+  int i;
+
+  if (pid == 0) {
+    memset(st, 0, sizeof(*st));
+    for (c = clat; c < &clat[NCPU]; c++) {
+      st->n += c->n;
+      st->total += c->total;
+      if (c->max > st->max) st->max = c->max;
+      for (i = 0; i < NLATBUCKET; i++) st->hist[i] += c->hist[i];
+    }
+    return 0;
+  }
+  for (p = proc; p < &proc[NPROC]; p++) {
+    acquire(&p->lock);
+    if (p->pid == pid && p->state != UNUSED) {
+      *st = plat[p - proc];
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Report the per-CPU scheduling counters.
+void schedstat(struct schedstat *st) {
+  struct cpu *c;
+  int i;
+
+  for (i = 0; i < NCPU; i++) {
+    c = &cpus[i];
+    st->cpu[i].runs = c->sruns;
+    st->cpu[i].steals = c->ssteals;
+    st->cpu[i].busy = c->sbusy;
+    st->cpu[i].idle = c->sidle;
+    st->cpu[i].nready = nready(c);
+  }
+}
+
 void setkilled(struct proc *p) {
   acquire(&p->lock);
   p->killed = 1;
@@ -606,7 +997,7 @@ void procdump(void) {
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %d %s", p->pid, state, p->prio, p->name);
     printf("\n");
   }
 }
@@ -24,6 +24,36 @@ struct cpu {
   struct context context;  // swtch() here to enter scheduler().
   int noff;                // Depth of push_off() nesting.
   int intena;              // Were interrupts enabled before push_off()?
+
+  // kalloc.c's per-CPU free page list.
+  struct spinlock kmemlock;  // protects the fields below
+  struct run *freelist;      // free pages owned by this CPU
+  int nfree;                 // length of freelist
+  uint64 khit;               // kalloc()s served from freelist
+  uint64 kmiss;              // kalloc()s that found freelist empty
+  uint64 ksteal;             // misses refilled from another CPU
+
+  // proc.c's per-CPU run queues, one FIFO per priority level.
+  struct spinlock rqlock;      // protects the fields below
+  struct proc *rqhead[NPRIO];  // RUNNABLE processes at each level
+  struct proc *rqtail[NPRIO];
+  int nready[NPRIO];  // length of each queue
+
+  // scheduling counters, written only by this CPU.
+  uint64 sruns;    // processes switched to
+  uint64 ssteals;  // of those, taken from another CPU's queues
+  uint64 sbusy;    // timer interrupts taken running a process
+  uint64 sidle;    // timer interrupts taken idle
+
+  uint64 quantum;  // c->proc's p->quantum, for clockintr()
+  uint64 tickat;   // when the running process's tick ends
+  int tickdue;     // it has ended; proctick() should charge it
+
+  // timer.c's heap of processes in sleepuntil().
+  struct spinlock tmlock;       // protects the fields below
+  struct proc *timers[NPROC];  // min-heap on p->wakeat
+  int ntimers;
+  uint64 tmnext;  // timers[0]->wakeat, or ~0 if none; read by tmarm() without tmlock
 };
 
 extern struct cpu cpus[NCPU];
@@ -81,20 +111,46 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A region of a file mapped into a process by mmap().
+struct vma {
+  uint64 addr;     // start address, page-aligned
+  uint64 len;      // length in bytes, page-aligned; 0 if unused
+  int prot;        // PROT_READ, PROT_WRITE, PROT_EXEC
+  int flags;       // MAP_SHARED or MAP_PRIVATE
+  struct file *f;  // the mapped file
+  uint off;        // file offset of addr
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
 
   // p->lock must be held when using these:
   enum procstate state;  // Process state
-  void *chan;            // If non-zero, sleeping on chan
   int killed;            // If non-zero, have been killed
   int xstate;            // Exit status to be returned to parent's wait
   int pid;               // Process ID
+  int prio;              // Scheduling level, 0 is highest
+  int cpu;               // CPU whose run queue gets the process
+  int slice;             // Ticks used of the quantum at prio
+  uint boost;            // Last priority boost applied to prio
+  uint64 quantum;        // Cycles in each of this process's ticks
+  uint64 readyat;        // When it last became RUNNABLE
 
   // wait_lock must be held when using this:
   struct proc *parent;  // Parent process
 
+  // the run queue's lock must be held when using this:
+  struct proc *rqnext;  // Next on a run queue
+
+  // the wait queue's lock must be held when using these:
+  void *chan;           // If non-zero, sleeping on chan
+  struct proc *wqnext;  // Next on the wait queue for chan
+
+  // the timer heap's lock must be held when using these:
+  uint64 wakeat;  // sleepuntil() wakeup time
+  int tmidx;      // index in the timer heap, or -1
+
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;                // Virtual address of kernel stack
   uint64 sz;                    // Size of process memory (bytes)
@@ -103,5 +159,7 @@ struct proc {
   struct context context;       // swtch() here to run process
   struct file *ofile[NOFILE];   // Open files
   struct inode *cwd;            // Current directory
+  struct vma vma[NVMA];         // Memory-mapped files
+  void (*kfn)(void);            // body of a kernel thread, else 0
   char name[16];                // Process name (debugging)
 };
@@ -190,6 +190,13 @@ static inline uint64 r_time() {
   return x;
 }
 
+// this hart's clock cycle counter
+static inline uint64 r_cycle() {
+  uint64 x;
+  asm volatile("csrr %0, cycle" : "=r"(x));
+  return x;
+}
+
 // enable device interrupts
 static inline void intr_on() { w_sstatus(r_sstatus() | SSTATUS_SIE); }
 
@@ -241,11 +248,18 @@ typedef uint64 *pagetable_t;  // 512 PTEs
 #define PGROUNDUP(sz) (((sz) + PGSIZE - 1) & ~(PGSIZE - 1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE - 1))
 
+#define SUPERPGSIZE (512 * PGSIZE)  // bytes per superpage, a level-1 leaf
+#define SUPERPGROUNDDOWN(a) (((a)) & ~(SUPERPGSIZE - 1))
+#define SUPERPGORDER 9  // kalloc_pages() order of a superpage
+
 #define PTE_V (1L << 0)  // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4)  // user can access
+#define PTE_A (1L << 6)  // accessed
+#define PTE_D (1L << 7)  // dirty
+#define PTE_COW (1L << 8)  // copy-on-write page (an RSW bit)
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -254,6 +268,9 @@ typedef uint64 *pagetable_t;  // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// does a valid PTE map memory, rather than point to a lower-level table?
+#define PTE_LEAF(pte) ((pte) & (PTE_R | PTE_W | PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK 0x1FF  // 9 bits
 #define PXSHIFT(level) (PGSHIFT + (9 * (level)))
@@ -0,0 +1,303 @@
+// Slab allocator for small kernel objects.
+//
+// A kmem_cache hands out objects of a single size, carved from
+// slabs of one page each, so that a 100-byte object no longer
+// takes a whole page from kalloc(). Each slab starts with a
+// struct slab, which kmem_cache_free() finds by rounding the
+// object's address down to the page. Each object is followed by
+// the link that strings it on its slab's free list, so that a
+// free object keeps the state the cache's constructor gave it.
+//
+// The constructor runs once per object, when its slab is made;
+// callers must free objects in that state (a released lock, say).
+//
+// Each CPU keeps a magazine of up to MAGSIZE free objects per
+// cache, locked like kalloc()'s per-CPU lists so that most
+// allocations and frees take only an uncontended lock. An empty
+// magazine refills, and a full one drains, half of MAGSIZE
+// objects at a time from the cache's slabs.
+//
+// When kalloc() runs out of pages it calls slabshrink(), which
+// drains every magazine and gives back every empty slab.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+#include "kstat.h"
+
+#define MAGSIZE 16  // free objects a CPU keeps per cache
+
+struct slab {
+  struct slab *next;  // on the cache's partial list
+  struct slab *prev;
+  struct kmem_cache *cache;
+  char *free;  // first free object; each free object's link points to the next
+  int inuse;   // objects not on free
+};
+
+struct magazine {
+  struct spinlock lock;  // taken before the cache's lock
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;     // object size asked for
+  uint stride;   // bytes from one object to the next, link included
+  int perslab;   // objects in a slab
+  void (*ctor)(void *);
+  struct slab *partial;  // slabs with some free objects
+  int nslab;
+  uint64 nalloc;  // kmem_cache_alloc()s, atomic
+  uint64 nfree;   // kmem_cache_free()s, atomic
+  struct magazine mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NCACHE];
+  int n;
+} kcaches;
+
+// The link after obj, which points to the next free object.
+#define OBJLINK(c, obj) (*(char **)((obj) + (c)->stride - sizeof(char *)))
+#define OBJSLAB(obj) ((struct slab *)PGROUNDDOWN((uint64)(obj)))
+
+void slabinit(void) { initlock(&kcaches.lock, "kcaches"); }
+
+// Make a cache of objects of size bytes. ctor, if not 0,
+// initializes each object once, when its slab is made.
+// Returns 0 if there is no room for another cache.
+struct kmem_cache *kmem_cache_create(char *name, uint size, void (*ctor)(void *)) {
+  struct kmem_cache *c;
+  uint stride;
+  int i;
+
+  stride = (size + sizeof(char *) - 1) / sizeof(char *) * sizeof(char *) + sizeof(char *);
+  if (size == 0 || sizeof(struct slab) + stride > PGSIZE) panic("kmem_cache_create");
+
+  acquire(&kcaches.lock);
+  if (kcaches.n == NCACHE) {
+    release(&kcaches.lock);
+    return 0;
+  }
+  c = &kcaches.cache[kcaches.n];
+  initlock(&c->lock, "kmem_cache");
+  for (i = 0; i < NCPU; i++) initlock(&c->mag[i].lock, "kmem_mag");
+  c->name = name;
+  c->size = size;
+  c->stride = stride;
+  c->perslab = (PGSIZE - sizeof(struct slab)) / stride;
+  c->ctor = ctor;
+  kcaches.n++;
+  release(&kcaches.lock);
+  return c;
+}
+
+// Make page into a slab for c and put it on c's partial list.
+// Caller holds c->lock.
+static void slabadd(struct kmem_cache *c, char *page) {
+  struct slab *s = (struct slab *)page;
+  char *obj;
+  int i;
+
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  // string the objects so that the lowest comes first.
+  for (i = c->perslab - 1; i >= 0; i--) {
+    obj = (char *)(s + 1) + i * c->stride;
+    if (c->ctor) c->ctor(obj);
+    OBJLINK(c, obj) = s->free;
+    s->free = obj;
+  }
+  s->prev = 0;
+  s->next = c->partial;
+  if (s->next) s->next->prev = s;
+  c->partial = s;
+  c->nslab++;
+}
+
+static void slabunlink(struct kmem_cache *c, struct slab *s) {
+  if (s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if (s->next) s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+// Fill magazine m with up to n objects from c's slabs.
+// Caller holds m->lock and c->lock.
+static void magfill(struct kmem_cache *c, struct magazine *m, int n) {
+  struct slab *s;
+  char *obj;
+
+  while (n > 0 && (s = c->partial) != 0) {
+    while (n > 0 && (obj = s->free) != 0) {
+      s->free = OBJLINK(c, obj);
+      s->inuse++;
+      m->obj[m->n++] = obj;
+      n--;
+    }
+    // a full slab is on no list until an object comes back.
+    if (s->free == 0) slabunlink(c, s);
+  }
+}
+
+// Return n objects from magazine m to their slabs, and give
+// back to kalloc() slabs that become empty, as long as more
+// than keep slabs remain. Caller holds m->lock and c->lock.
+static void magdrain(struct kmem_cache *c, struct magazine *m, int n, int keep) {
+  struct slab *s;
+  char *obj;
+
+  while (n-- > 0) {
+    obj = m->obj[--m->n];
+    s = OBJSLAB(obj);
+    if (s->cache != c) panic("kmem_cache_free: wrong cache");
+    if (s->free == 0) {
+      s->prev = 0;
+      s->next = c->partial;
+      if (s->next) s->next->prev = s;
+      c->partial = s;
+    }
+    OBJLINK(c, obj) = s->free;
+    s->free = obj;
+    if (--s->inuse == 0 && c->nslab > keep) {
+      slabunlink(c, s);
+      c->nslab--;
+      kfree((char *)s);
+    }
+  }
+}
+
+// Allocate an object from c.
+// Returns 0 if the memory cannot be allocated.
+void *kmem_cache_alloc(struct kmem_cache *c) {
+  struct magazine *m;
+  char *page;
+  void *obj;
+
+  obj = 0;
+  // stay on this CPU so that m remains ours.
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if (m->n == 0) {
+    acquire(&c->lock);
+    magfill(c, m, MAGSIZE / 2);
+    release(&c->lock);
+  }
+  if (m->n == 0) {
+    // every slab is full: make another. kalloc() may call
+    // slabshrink(), so hold none of the cache's locks.
+    release(&m->lock);
+    page = kalloc();
+    acquire(&m->lock);
+    if (page) {
+      acquire(&c->lock);
+      slabadd(c, page);
+      magfill(c, m, MAGSIZE / 2);
+      release(&c->lock);
+    }
+  }
+  if (m->n > 0) obj = m->obj[--m->n];
+  release(&m->lock);
+  pop_off();
+
+  if (obj) __sync_fetch_and_add(&c->nalloc, 1);
+  return obj;
+}
+
+// Free an object that kmem_cache_alloc(c) returned.
+void kmem_cache_free(struct kmem_cache *c, void *obj) {
+  struct magazine *m;
+
+  if ((char *)obj < (char *)(OBJSLAB(obj) + 1) || ((char *)obj - (char *)(OBJSLAB(obj) + 1)) % c->stride != 0)
+    panic("kmem_cache_free");
+
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if (m->n == MAGSIZE) {
+    acquire(&c->lock);
+    magdrain(c, m, MAGSIZE / 2, 1);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  release(&m->lock);
+  pop_off();
+
+  __sync_fetch_and_add(&c->nfree, 1);
+}
+
+// Give back to kalloc() every page the caches can spare:
+// drain all the magazines and free the empty slabs.
+// Called by kalloc() when it has no free pages; the caller
+// must hold no cache's locks. Returns the pages freed.
+int slabshrink(void) {
+  struct kmem_cache *c;
+  struct slab *s, *next;
+  int i, n, cpu, freed;
+
+  acquire(&kcaches.lock);
+  n = kcaches.n;
+  release(&kcaches.lock);
+
+  freed = 0;
+  for (i = 0; i < n; i++) {
+    c = &kcaches.cache[i];
+    for (cpu = 0; cpu < NCPU; cpu++) {
+      acquire(&c->mag[cpu].lock);
+      acquire(&c->lock);
+      freed -= c->nslab;
+      magdrain(c, &c->mag[cpu], c->mag[cpu].n, 0);
+      freed += c->nslab;
+      release(&c->lock);
+      release(&c->mag[cpu].lock);
+    }
+    acquire(&c->lock);
+    for (s = c->partial; s; s = next) {
+      next = s->next;
+      if (s->inuse > 0) continue;
+      slabunlink(c, s);
+      c->nslab--;
+      freed++;
+      kfree((char *)s);
+    }
+    release(&c->lock);
+  }
+  return freed;
+}
+
+// Report each cache's size and use.
+void slabstat(struct slabstat *st) {
+  struct kmem_cache *c;
+  int i, n, cpu;
+
+  memset(st, 0, sizeof(*st));
+  acquire(&kcaches.lock);
+  n = kcaches.n;
+  release(&kcaches.lock);
+
+  for (i = 0; i < n; i++) {
+    c = &kcaches.cache[i];
+    acquire(&c->lock);
+    safestrcpy(st->cache[i].name, c->name, sizeof(st->cache[i].name));
+    st->cache[i].size = c->size;
+    st->cache[i].perslab = c->perslab;
+    st->cache[i].slabs = c->nslab;
+    // other CPUs' magazines may be changing; a rough count will do.
+    for (cpu = 0; cpu < NCPU; cpu++) st->cache[i].cached += __atomic_load_n(&c->mag[cpu].n, __ATOMIC_RELAXED);
+    st->cache[i].alloc = c->nalloc;
+    st->cache[i].inuse = c->nalloc - c->nfree;
+    release(&c->lock);
+  }
+}
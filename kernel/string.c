@@ -1,11 +1,39 @@
 #include "types.h"
 
+// memset(), memcmp() and memmove() work a 64-bit word at a
+// time, eight words per loop iteration, once the pointers are
+// aligned; a byte loop handles the unaligned head and tail.
+// Whole aligned pages, as kalloc() and uvmcopy() use, thus run
+// entirely in the unrolled loops. Word accesses must be
+// aligned: the kernel has no handler for misaligned ones.
+
+typedef uint64 __attribute__((may_alias)) word;
+
+#define WSZ sizeof(word)
+#define ALIGNED(p) (((uint64)(p) & (WSZ - 1)) == 0)
+
 void *memset(void *dst, int c, uint n) {
   char *cdst = (char *)dst;
-  int i;
-  for (i = 0; i < n; i++) {
-    cdst[i] = c;
+  word w, *wdst;
+
+  if (n >= 2 * WSZ) {
+    for (; !ALIGNED(cdst); n--) *cdst++ = c;
+    w = (uchar)c * 0x0101010101010101UL;
+    wdst = (word *)cdst;
+    for (; n >= 8 * WSZ; n -= 8 * WSZ, wdst += 8) {
+      wdst[0] = w;
+      wdst[1] = w;
+      wdst[2] = w;
+      wdst[3] = w;
+      wdst[4] = w;
+      wdst[5] = w;
+      wdst[6] = w;
+      wdst[7] = w;
+    }
+    for (; n >= WSZ; n -= WSZ) *wdst++ = w;
+    cdst = (char *)wdst;
   }
+  while (n-- > 0) *cdst++ = c;
   return dst;
 }
 
@@ -14,6 +42,12 @@ int memcmp(const void *v1, const void *v2, uint n) {
 
   s1 = v1;
   s2 = v2;
+  if (n >= 2 * WSZ && ((uint64)s1 & (WSZ - 1)) == ((uint64)s2 & (WSZ - 1))) {
+    for (; !ALIGNED(s1); n--, s1++, s2++)
+      if (*s1 != *s2) return *s1 - *s2;
+    // skip the equal words; the bytes find the difference.
+    for (; n >= WSZ && *(word *)s1 == *(word *)s2; n -= WSZ) s1 += WSZ, s2 += WSZ;
+  }
   while (n-- > 0) {
     if (*s1 != *s2) return *s1 - *s2;
     s1++, s2++;
@@ -22,9 +56,45 @@ int memcmp(const void *v1, const void *v2, uint n) {
   return 0;
 }
 
+// Copy forward from word-aligned d to s, which is k bytes
+// past a word boundary, assembling each word from two
+// aligned loads. Return the number of bytes copied.
+static uint movealigned(word *d, const char *s, uint n, int k) {
+  const word *ws;
+  word lo, hi;
+  uint i;
+
+  if (k == 0) {
+    ws = (const word *)s;
+    for (i = 0; n - i >= 8 * WSZ; i += 8 * WSZ, d += 8, ws += 8) {
+      d[0] = ws[0];
+      d[1] = ws[1];
+      d[2] = ws[2];
+      d[3] = ws[3];
+      d[4] = ws[4];
+      d[5] = ws[5];
+      d[6] = ws[6];
+      d[7] = ws[7];
+    }
+    for (; n - i >= WSZ; i += WSZ) *d++ = *ws++;
+    return i;
+  }
+  // the loads stay within the aligned words that hold
+  // source bytes, so they cannot cross into another page.
+  ws = (const word *)(s - k);
+  lo = *ws++;
+  for (i = 0; n - i >= WSZ; i += WSZ) {
+    hi = *ws++;
+    *d++ = (lo >> (8 * k)) | (hi << (64 - 8 * k));
+    lo = hi;
+  }
+  return i;
+}
+
 void *memmove(void *dst, const void *src, uint n) {
   const char *s;
   char *d;
+  uint i;
 
   if (n == 0) return dst;
 
@@ -33,9 +103,25 @@ void *memmove(void *dst, const void *src, uint n) {
   if (s < d && s + n > d) {
     s += n;
     d += n;
+    if (n >= 2 * WSZ && ((uint64)s & (WSZ - 1)) == ((uint64)d & (WSZ - 1))) {
+      for (; !ALIGNED(d); n--) *--d = *--s;
+      for (; n >= WSZ; n -= WSZ) {
+        d -= WSZ;
+        s -= WSZ;
+        *(word *)d = *(const word *)s;
+      }
+    }
     while (n-- > 0) *--d = *--s;
-  } else
+  } else {
+    if (n >= 2 * WSZ) {
+      for (; !ALIGNED(d); n--) *d++ = *s++;
+      i = movealigned((word *)d, s, n, (uint64)s & (WSZ - 1));
+      d += i;
+      s += i;
+      n -= i;
+    }
     while (n-- > 0) *d++ = *s++;
+  }
 
   return dst;
 }
@@ -20,6 +20,7 @@ int fetchaddr(uint64 addr, uint64 *ip) {
 // Returns length of string, not including nul, or -1 for error.
 int fetchstr(uint64 addr, char *buf, int max) {
   struct proc *p = myproc();
+  vmaprefault(p, addr, max, 0);
   if (copyinstr(p->pagetable, buf, addr, max) < 0) return -1;
   return strlen(buf);
 }
@@ -49,8 +50,14 @@ void argint(int n, int *ip) { *ip = argraw(n); }
 
 // Retrieve an argument as a pointer.
 // Doesn't check for legality, since
-// copyin/copyout will do that.
-void argaddr(int n, uint64 *ip) { *ip = argraw(n); }
+// copyin/copyout will do that. Faults in the page of a mapped
+// file it points into, and the next, now, while no locks are
+// held, since copyin/copyout will not; system calls that take
+// a longer buffer fault in the rest themselves.
+void argaddr(int n, uint64 *ip) {
+  *ip = argraw(n);
+  vmaprefault(myproc(), *ip, PGSIZE, 0);
+}
 
 // Fetch the nth word-sized system call argument as a null-terminated string.
 // Copies into buf, at most max.
@@ -83,6 +90,23 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_kmemstat(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_rastat(void);
+extern uint64 sys_logstat(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_sync(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_getpriority(void);
+extern uint64 sys_schedstat(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_uptimens(void);
+extern uint64 sys_setquantum(void);
+extern uint64 sys_getquantum(void);
+extern uint64 sys_schedlat(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_slabstat(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -90,7 +114,12 @@ static uint64 (*syscalls[])(void) = {
     [SYS_fork] sys_fork,   [SYS_exit] sys_exit,     [SYS_wait] sys_wait,   [SYS_pipe] sys_pipe,   [SYS_read] sys_read,     [SYS_kill] sys_kill,
     [SYS_exec] sys_exec,   [SYS_fstat] sys_fstat,   [SYS_chdir] sys_chdir, [SYS_dup] sys_dup,     [SYS_getpid] sys_getpid, [SYS_sbrk] sys_sbrk,
     [SYS_sleep] sys_sleep, [SYS_uptime] sys_uptime, [SYS_open] sys_open,   [SYS_write] sys_write, [SYS_mknod] sys_mknod,   [SYS_unlink] sys_unlink,
-    [SYS_link] sys_link,   [SYS_mkdir] sys_mkdir,   [SYS_close] sys_close,
+    [SYS_link] sys_link,   [SYS_mkdir] sys_mkdir,   [SYS_close] sys_close, [SYS_kmemstat] sys_kmemstat,
+    [SYS_mmap] sys_mmap,   [SYS_munmap] sys_munmap, [SYS_rastat] sys_rastat, [SYS_logstat] sys_logstat,
+    [SYS_fsync] sys_fsync, [SYS_sync] sys_sync, [SYS_setpriority] sys_setpriority, [SYS_getpriority] sys_getpriority,
+    [SYS_schedstat] sys_schedstat, [SYS_nanosleep] sys_nanosleep, [SYS_uptimens] sys_uptimens,
+    [SYS_setquantum] sys_setquantum, [SYS_getquantum] sys_getquantum, [SYS_schedlat] sys_schedlat,
+    [SYS_splice] sys_splice, [SYS_slabstat] sys_slabstat,
 };
 
 void syscall(void) {
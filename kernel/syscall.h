@@ -20,3 +20,20 @@
 #define SYS_link 19
 #define SYS_mkdir 20
 #define SYS_close 21
+#define SYS_kmemstat 22
+#define SYS_mmap 23
+#define SYS_munmap 24
+#define SYS_rastat 25
+#define SYS_logstat 26
+#define SYS_fsync 27
+#define SYS_sync 28
+#define SYS_setpriority 29
+#define SYS_getpriority 30
+#define SYS_schedstat 31
+#define SYS_nanosleep 32
+#define SYS_uptimens 33
+#define SYS_setquantum 34
+#define SYS_getquantum 35
+#define SYS_schedlat 36
+#define SYS_splice 37
+#define SYS_slabstat 38
@@ -62,7 +62,8 @@ uint64 sys_read(void) {
   argaddr(1, &p);
   argint(2, &n);
   if (argfd(0, 0, &f) < 0) return -1;
-  return fileread(f, p, n);
+  if (n > 0) vmaprefault(myproc(), p, n, 1);
+  return fileread(f, 1, p, n);
 }
 
 uint64 sys_write(void) {
@@ -73,8 +74,20 @@ uint64 sys_write(void) {
   argaddr(1, &p);
   argint(2, &n);
   if (argfd(0, 0, &f) < 0) return -1;
+  if (n > 0) vmaprefault(myproc(), p, n, 0);
 
-  return filewrite(f, p, n);
+  return filewrite(f, 1, p, n);
+}
+
+// move up to n bytes from one file to another without
+// copying them through user space; one must be a pipe.
+uint64 sys_splice(void) {
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if (argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0) return -1;
+  return filesplice(in, out, n);
 }
 
 uint64 sys_close(void) {
@@ -87,6 +100,22 @@ uint64 sys_close(void) {
   return 0;
 }
 
+// All of the file system shares one log, so making one
+// file's changes durable commits everyone's.
+uint64 sys_fsync(void) {
+  struct file *f;
+
+  if (argfd(0, 0, &f) < 0) return -1;
+  if (f->type == FD_PIPE) return -1;
+  log_sync();
+  return 0;
+}
+
+uint64 sys_sync(void) {
+  log_sync();
+  return 0;
+}
+
 uint64 sys_fstat(void) {
   struct file *f;
   uint64 st;  // user pointer to struct stat
@@ -437,3 +466,25 @@ uint64 sys_pipe(void) {
   }
   return 0;
 }
+
+uint64 sys_mmap(void) {
+  uint64 addr, len;
+  int prot, flags, off;
+  struct file *f;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if (argfd(4, 0, &f) < 0 || off < 0) return -1;
+  return mmap(addr, len, prot, flags, f, off);
+}
+
+uint64 sys_munmap(void) {
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return munmap(addr, len);
+}
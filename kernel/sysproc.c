@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "kstat.h"
 
 uint64 sys_exit(void) {
   int n;
@@ -35,21 +36,18 @@ uint64 sys_sbrk(void) {
 
 uint64 sys_sleep(void) {
   int n;
-  uint ticks0;
 
   argint(0, &n);
   if (n < 0) n = 0;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while (ticks - ticks0 < n) {
-    if (killed(myproc())) {
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return sleepuntil(r_time() + (uint64)n * TICKCYCLES);
+}
+
+// sleep for the given number of nanoseconds.
+uint64 sys_nanosleep(void) {
+  uint64 ns;
+
+  argaddr(0, &ns);
+  return sleepuntil(r_time() + ns / (1000000000 / TIMEBASE));
 }
 
 uint64 sys_kill(void) {
@@ -59,13 +57,106 @@ uint64 sys_kill(void) {
   return kill(pid);
 }
 
-// return how many clock tick interrupts have occurred
+uint64 sys_setpriority(void) {
+  int pid, prio;
+
+  argint(0, &pid);
+  argint(1, &prio);
+  return setpriority(pid, prio);
+}
+
+uint64 sys_getpriority(void) {
+  int pid;
+
+  argint(0, &pid);
+  return getpriority(pid);
+}
+
+uint64 sys_setquantum(void) {
+  int pid, us;
+
+  argint(0, &pid);
+  argint(1, &us);
+  return setquantum(pid, us);
+}
+
+uint64 sys_getquantum(void) {
+  int pid;
+
+  argint(0, &pid);
+  return getquantum(pid);
+}
+
+// return how many clock ticks have passed
 // since start.
-uint64 sys_uptime(void) {
-  uint xticks;
+uint64 sys_uptime(void) { return r_time() / TICKCYCLES; }
+
+// return how many nanoseconds have passed since start.
+uint64 sys_uptimens(void) { return r_time() * (1000000000 / TIMEBASE); }
+
+// copy the page allocator's statistics to user space.
+uint64 sys_kmemstat(void) {
+  uint64 addr;
+  struct kmemstat st;
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  argaddr(0, &addr);
+  kmemstat(&st);
+  if (copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0) return -1;
+  return 0;
+}
+
+// copy the slab caches' statistics to user space.
+uint64 sys_slabstat(void) {
+  uint64 addr;
+  struct slabstat st;
+
+  argaddr(0, &addr);
+  slabstat(&st);
+  if (copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0) return -1;
+  return 0;
+}
+
+// copy the buffer cache's read-ahead statistics to user space.
+uint64 sys_rastat(void) {
+  uint64 addr;
+  struct rastat st;
+
+  argaddr(0, &addr);
+  rastat(&st);
+  if (copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0) return -1;
+  return 0;
+}
+
+uint64 sys_logstat(void) {
+  uint64 addr;
+  struct logstat st;
+
+  argaddr(0, &addr);
+  logstat(&st);
+  if (copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0) return -1;
+  return 0;
+}
+
+uint64 sys_schedstat(void) {
+  uint64 addr;
+  struct schedstat st;
+
+  argaddr(0, &addr);
+  schedstat(&st);
+  if (copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0) return -1;
+  return 0;
+}
+
+// copy a process's run queue latency, or the system's if
+// pid is 0, to user space.
+uint64 sys_schedlat(void) {
+  int pid;
+  uint64 addr;
+  struct schedlat st;
+
+  argint(0, &pid);
+  argaddr(1, &addr);
+  if (schedlat(pid, &st) < 0) return -1;
+  if (copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0) return -1;
+  return 0;
 }
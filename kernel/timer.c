@@ -0,0 +1,144 @@
+// High-resolution sleep and tickless timer interrupts.
+//
+// Each CPU keeps the processes sleeping in sleepuntil() on it
+// in a min-heap ordered by wakeup time, and programs its timer
+// (stimecmp) for the earliest of:
+//   - the first wakeup time in its heap;
+//   - the end of the running process's tick, if it is running one;
+//   - one tick from now, if it is idle but another CPU is busy,
+//     so that it keeps looking for work to steal;
+//   - IDLETICKS from now, if all CPUs are idle.
+// So an idle machine takes few timer interrupts, and a sleeper
+// is woken when its time comes rather than at the next tick.
+//
+// Times are in cycles of the time CSR, TIMEBASE per second.
+//
+// Lock order: c->tmlock, then wait-queue locks, then p->lock.
+// sleepuntil() sleeps holding tmlock and tmexpire() wakes
+// processes holding it. The scheduler arms the timer holding
+// p->lock, so tmarm() must not take tmlock; it reads c->tmnext.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+void tminit(void) {
+  struct cpu *c;
+
+  for (c = cpus; c < &cpus[NCPU]; c++) {
+    initlock(&c->tmlock, "timers");
+    c->tmnext = ~0ULL;
+  }
+}
+
+// Publish c's earliest wakeup time for tmarm().
+// Caller holds c->tmlock.
+static void tmpublish(struct cpu *c) { __atomic_store_n(&c->tmnext, c->ntimers > 0 ? c->timers[0]->wakeat : ~0ULL, __ATOMIC_RELAXED); }
+
+static void tmswap(struct cpu *c, int i, int j) {
+  struct proc *p = c->timers[i];
+
+  c->timers[i] = c->timers[j];
+  c->timers[j] = p;
+  c->timers[i]->tmidx = i;
+  c->timers[j]->tmidx = j;
+}
+
+// Move the process at heap index i up or down to its place.
+static void tmfix(struct cpu *c, int i) {
+  int j;
+
+  while (i > 0 && c->timers[i]->wakeat < c->timers[(i - 1) / 2]->wakeat) {
+    tmswap(c, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+  while ((j = 2 * i + 1) < c->ntimers) {
+    if (j + 1 < c->ntimers && c->timers[j + 1]->wakeat < c->timers[j]->wakeat) j++;
+    if (c->timers[i]->wakeat <= c->timers[j]->wakeat) break;
+    tmswap(c, i, j);
+    i = j;
+  }
+}
+
+// Take p out of c's heap. Caller holds c->tmlock.
+static void tmremove(struct cpu *c, struct proc *p) {
+  int i = p->tmidx;
+
+  c->ntimers--;
+  if (i != c->ntimers) {
+    tmswap(c, i, c->ntimers);
+    tmfix(c, i);
+  }
+  p->tmidx = -1;
+  tmpublish(c);
+}
+
+// Sleep until the time CSR reaches when.
+// Return -1 if killed first, else 0.
+int sleepuntil(uint64 when) {
+  struct proc *p = myproc();
+  struct cpu *c;
+
+  push_off();
+  c = mycpu();
+  acquire(&c->tmlock);
+  pop_off();
+
+  p->wakeat = when;
+  p->tmidx = c->ntimers++;
+  c->timers[p->tmidx] = p;
+  tmfix(c, p->tmidx);
+  tmpublish(c);
+
+  while (r_time() < when) {
+    if (killed(p)) break;
+    sleep(&p->wakeat, &c->tmlock);
+  }
+  // tmexpire() removes p if its time came; kill() does not.
+  if (p->tmidx >= 0) tmremove(c, p);
+  release(&c->tmlock);
+
+  return r_time() < when ? -1 : 0;
+}
+
+// Wake the processes on this CPU whose time has come.
+void tmexpire(void) {
+  struct cpu *c = mycpu();
+  struct proc *p;
+  uint64 now = r_time();
+
+  acquire(&c->tmlock);
+  while (c->ntimers > 0 && (p = c->timers[0])->wakeat <= now) {
+    tmremove(c, p);
+    wakeup(&p->wakeat);
+  }
+  release(&c->tmlock);
+}
+
+// Program this CPU's timer for its next deadline.
+// Interrupts must be off. Takes no locks, so the scheduler
+// may call it holding p->lock.
+void tmarm(void) {
+  struct cpu *c = mycpu(), *o;
+  uint64 next, first;
+
+  if (c->proc) {
+    next = c->tickat;
+  } else {
+    next = r_time() + IDLETICKS * TICKCYCLES;
+    for (o = cpus; o < &cpus[NCPU]; o++) {
+      if (o != c && o->proc) {
+        next = r_time() + TICKCYCLES;
+        break;
+      }
+    }
+  }
+
+  if ((first = __atomic_load_n(&c->tmnext, __ATOMIC_RELAXED)) < next) next = first;
+
+  w_stimecmp(next);
+}
@@ -55,6 +55,12 @@ void usertrap(void) {
     syscall();
   } else if ((which_dev = devintr()) != 0) {
     // ok
+  } else if (r_scause() == 15 && cowfault(p->pagetable, PGROUNDDOWN(r_stval())) == 0) {
+    // store page fault on a copy-on-write page.
+  } else if ((r_scause() == 13 || r_scause() == 15) && lazyalloc(p->pagetable, r_stval(), p->sz, 1) == 0) {
+    // first touch of a page that sbrk() handed out.
+  } else if ((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) && vmafault(p, r_stval(), r_scause()) == 0) {
+    // first touch of a page of a memory-mapped file.
   } else {
     printf("usertrap(): unexpected scause 0x%lx pid=%d\n", r_scause(), p->pid);
     printf("            sepc=0x%lx stval=0x%lx\n", r_sepc(), r_stval());
@@ -63,8 +69,9 @@ void usertrap(void) {
 
   if (killed(p)) exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if (which_dev == 2) yield();
+  // charge the tick if this is a timer interrupt;
+  // maybe give up the CPU.
+  if (which_dev == 2) proctick();
 
   usertrapret();
 }
@@ -130,8 +137,9 @@ void kerneltrap() {
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if (which_dev == 2 && myproc() != 0) yield();
+  // charge the tick if this is a timer interrupt;
+  // maybe give up the CPU.
+  if (which_dev == 2 && myproc() != 0) proctick();
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -139,18 +147,35 @@ void kerneltrap() {
   w_sstatus(sstatus);
 }
 
+// handle a timer interrupt. it may be the end of the
+// running process's tick, for proctick() to charge,
+// or a sleepuntil() deadline.
 void clockintr() {
-  if (cpuid() == 0) {
-    acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
-    release(&tickslock);
+  struct cpu *c = mycpu();
+  uint64 now = r_time();
+  int boost;
+
+  if (c->proc)
+    c->sbusy++;
+  else
+    c->sidle++;
+
+  // any CPU may be the one still taking interrupts.
+  acquire(&tickslock);
+  boost = now / TICKCYCLES / BOOSTTICKS != ticks / BOOSTTICKS;
+  ticks = now / TICKCYCLES;
+  release(&tickslock);
+  if (boost) prioboost();
+
+  if (c->proc && now >= c->tickat) {
+    c->tickat = now + c->quantum;
+    c->tickdue = 1;
   }
+  tmexpire();
 
   // ask for the next timer interrupt. this also clears
-  // the interrupt request. 1000000 is about a tenth
-  // of a second.
-  w_stimecmp(r_time() + 1000000);
+  // the interrupt request.
+  tmarm();
 }
 
 // check if it's an external interrupt or software interrupt,
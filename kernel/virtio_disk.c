@@ -22,7 +22,7 @@
 static struct disk {
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
-  // disk operations. there are NUM descriptors.
+  // disk operations. there are disk.num descriptors.
   // most commands consist of a "chain" (a linked list) of a couple of
   // these descriptors.
   struct virtq_desc *desc;
@@ -30,21 +30,23 @@ static struct disk {
   // a ring in which the driver writes descriptor numbers
   // that the driver would like the device to process.  it only
   // includes the head descriptor of each chain. the ring has
-  // NUM elements.
+  // disk.num elements.
   struct virtq_avail *avail;
 
   // a ring in which the device writes descriptor numbers that
   // the device has finished processing (just the head of each chain).
-  // there are NUM used ring entries.
+  // there are disk.num used ring entries.
   struct virtq_used *used;
 
   // our own book-keeping.
+  uint num;         // queue size agreed with the device
   char free[NUM];   // is a descriptor free?
   uint16 used_idx;  // we've looked this far in used[2..NUM].
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
-  // indexed by first descriptor index of chain.
+  // indexed by descriptor: b for each data descriptor,
+  // status for the first descriptor of a chain.
   struct {
     struct buf *b;
     char status;
@@ -106,7 +108,8 @@ void virtio_disk_init(void) {
   // check maximum queue size.
   uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
   if (max == 0) panic("virtio disk has no queue 0");
-  if (max < NUM) panic("virtio disk max queue too short");
+  for (disk.num = NUM; disk.num > max; disk.num /= 2);
+  if (disk.num < NBULK + 2) panic("virtio disk max queue too short");
 
   // allocate and zero queue memory.
   disk.desc = kalloc();
@@ -118,7 +121,7 @@ void virtio_disk_init(void) {
   memset(disk.used, 0, PGSIZE);
 
   // set queue size.
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  *R(VIRTIO_MMIO_QUEUE_NUM) = disk.num;
 
   // write physical addresses.
   *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
@@ -131,8 +134,8 @@ void virtio_disk_init(void) {
   // queue is ready.
   *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
 
-  // all NUM descriptors start out unused.
-  for (int i = 0; i < NUM; i++) disk.free[i] = 1;
+  // all descriptors start out unused.
+  for (int i = 0; i < disk.num; i++) disk.free[i] = 1;
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
@@ -143,7 +146,7 @@ void virtio_disk_init(void) {
 
 // find a free descriptor, mark it non-free, return its index.
 static int alloc_desc() {
-  for (int i = 0; i < NUM; i++) {
+  for (int i = 0; i < disk.num; i++) {
     if (disk.free[i]) {
       disk.free[i] = 0;
       return i;
@@ -154,12 +157,13 @@ static int alloc_desc() {
 
 // mark a descriptor as free.
 static void free_desc(int i) {
-  if (i >= NUM) panic("free_desc 1");
+  if (i >= disk.num) panic("free_desc 1");
   if (disk.free[i]) panic("free_desc 2");
   disk.desc[i].addr = 0;
   disk.desc[i].len = 0;
   disk.desc[i].flags = 0;
   disk.desc[i].next = 0;
+  disk.info[i].b = 0;
   disk.free[i] = 1;
   wakeup(&disk.free[0]);
 }
@@ -177,10 +181,9 @@ static void free_chain(int i) {
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
-static int alloc3_desc(int *idx) {
-  for (int i = 0; i < 3; i++) {
+// allocate n descriptors (they need not be contiguous).
+static int alloc_descs(int *idx, int n) {
+  for (int i = 0; i < n; i++) {
     idx[i] = alloc_desc();
     if (idx[i] < 0) {
       for (int j = 0; j < i; j++) free_desc(idx[j]);
@@ -190,25 +193,41 @@ static int alloc3_desc(int *idx) {
   return 0;
 }
 
-void virtio_disk_rw(struct buf *b, int write) {
-  uint64 sector = b->blockno * (BSIZE / 512);
+// start reading or writing the n bufs in bs[], which must
+// hold consecutive blocks of the disk, with one request.
+// returns without waiting; each buf's b->disk stays 1 until
+// virtio_disk_intr() sees the request finish.
+void virtio_disk_submit(struct buf **bs, int n, int write) {
+  for (int i = 1; i < n; i++) {
+    if (bs[i]->blockno != bs[0]->blockno + i) panic("virtio_disk_submit: not consecutive");
+  }
+  virtio_disk_submit_at(bs, n, bs[0]->blockno, write);
+}
+
+// like virtio_disk_submit(), but transfer the bufs to or from
+// the n blocks starting at blockno, whatever blocks they hold.
+void virtio_disk_submit_at(struct buf **bs, int n, uint blockno, int write) {
+  uint64 sector = blockno * (BSIZE / 512);
+
+  if (n < 1 || n > NBULK) panic("virtio_disk_submit");
 
   acquire(&disk.vdisk_lock);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // one descriptor for type/reserved/sector, then the data, then
+  // one for a 1-byte status result. the data may be spread over
+  // several descriptors, one per buf here.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the descriptors.
+  int idx[NBULK + 2];
   while (1) {
-    if (alloc3_desc(idx) == 0) {
+    if (alloc_descs(idx, n + 2) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -225,48 +244,57 @@ void virtio_disk_rw(struct buf *b, int write) {
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64)b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if (write)
-    disk.desc[idx[1]].flags = 0;  // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE;  // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for (int i = 1; i <= n; i++) {
+    struct buf *b = bs[i - 1];
+    disk.desc[idx[i]].addr = (uint64)b->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if (write)
+      disk.desc[idx[i]].flags = 0;  // device reads b->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE;  // device writes b->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i + 1];
 
-  disk.info[idx[0]].status = 0xff;  // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64)&disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE;  // device writes the status
-  disk.desc[idx[2]].next = 0;
+    // record struct buf for virtio_disk_intr().
+    b->disk = 1;
+    disk.info[idx[i]].b = b;
+  }
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.info[idx[0]].status = 0xff;  // device writes 0 on success
+  disk.desc[idx[n + 1]].addr = (uint64)&disk.info[idx[0]].status;
+  disk.desc[idx[n + 1]].len = 1;
+  disk.desc[idx[n + 1]].flags = VRING_DESC_F_WRITE;  // device writes the status
+  disk.desc[idx[n + 1]].next = 0;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  disk.avail->ring[disk.avail->idx % disk.num] = idx[0];
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1;  // not % NUM ...
+  disk.avail->idx += 1;  // not % disk.num ...
 
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0;  // value is queue number
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  release(&disk.vdisk_lock);
+}
+
+// wait for virtio_disk_intr() to say that b's request has finished.
+void virtio_disk_wait(struct buf *b) {
+  acquire(&disk.vdisk_lock);
   while (b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+void virtio_disk_rw(struct buf *b, int write) {
+  virtio_disk_submit(&b, 1, write);
+  virtio_disk_wait(b);
+}
+
 void virtio_disk_intr() {
   acquire(&disk.vdisk_lock);
 
@@ -285,13 +313,23 @@ void virtio_disk_intr() {
 
   while (disk.used_idx != disk.used->idx) {
     __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+    int id = disk.used->ring[disk.used_idx % disk.num].id;
 
     if (disk.info[id].status != 0) panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;  // disk is done with buf
-    wakeup(b);
+    // hand each buf of the request back, then free the chain.
+    for (int i = id;; i = disk.desc[i].next) {
+      struct buf *b = disk.info[i].b;
+      if (b) {
+        void (*iodone)(struct buf *) = b->iodone;
+        b->disk = 0;  // disk is done with buf
+        b->iodone = 0;
+        wakeup(b);
+        if (iodone) iodone(b);
+      }
+      if ((disk.desc[i].flags & VRING_DESC_F_NEXT) == 0) break;
+    }
+    free_chain(id);
 
     disk.used_idx += 1;
   }
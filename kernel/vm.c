@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -19,8 +21,7 @@ extern char trampoline[];  // trampoline.S
 pagetable_t kvmmake(void) {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t)kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t)kalloc_zeroed();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -34,7 +35,8 @@ pagetable_t kvmmake(void) {
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext - KERNBASE, PTE_R | PTE_X);
 
-  // map kernel data and the physical RAM we'll make use of.
+  // map kernel data and the physical RAM we'll make use of,
+  // with superpages from the first 2 MB boundary on.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP - (uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -62,6 +64,21 @@ void kvminithart() {
   sfence_vma();
 }
 
+// Split the superpage that level-1 leaf *pte maps into 512
+// 4 KB pages with the same permissions, using table as the
+// new page-table page, or a newly allocated one if table is 0.
+// Returns 0 on success, -1 if out of memory.
+static int splitsuper(pte_t *pte, pagetable_t table) {
+  uint64 pa = PTE2PA(*pte);
+  uint flags = PTE_FLAGS(*pte);
+  int i;
+
+  if (table == 0 && (table = (pagetable_t)kalloc()) == 0) return -1;
+  for (i = 0; i < 512; i++) table[i] = PA2PTE(pa + i * PGSIZE) | flags;
+  *pte = PA2PTE(table) | PTE_V;
+  return 0;
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -74,22 +91,83 @@ void kvminithart() {
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A level-1 PTE may instead be a leaf that maps a 2 MB
+// superpage. walk() splits such a superpage into 4 KB
+// pages, so that it can return a level-0 PTE; the split
+// needs a page-table page even if alloc is 0, and walk()
+// returns 0 if it cannot get one.
 pte_t *walk(pagetable_t pagetable, uint64 va, int alloc) {
   if (va >= MAXVA) panic("walk");
 
   for (int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
+    if ((*pte & PTE_V) && PTE_LEAF(*pte)) {
+      if (level != 1) panic("walk: leaf");
+      if (splitsuper(pte, 0) != 0) return 0;
+    }
     if (*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if (!alloc || (pagetable = (pde_t *)kalloc()) == 0) return 0;
-      memset(pagetable, 0, PGSIZE);
+      if (!alloc || (pagetable = (pde_t *)kalloc_zeroed()) == 0) return 0;
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
   return &pagetable[PX(0, va)];
 }
 
+// Return the leaf PTE that maps va, at whatever level, or
+// 0 if there is none, without splitting superpages. Set
+// *pa to the physical address of va's 4 KB page.
+static pte_t *walkleaf(pagetable_t pagetable, uint64 va, uint64 *pa) {
+  pte_t *pte;
+
+  for (int level = 2; level >= 0; level--) {
+    pte = &pagetable[PX(level, va)];
+    if ((*pte & PTE_V) == 0) return 0;
+    if (PTE_LEAF(*pte)) {
+      *pa = PTE2PA(*pte) + PGROUNDDOWN(va & ((1L << PXSHIFT(level)) - 1));
+      return pte;
+    }
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  }
+  return 0;
+}
+
+// Return the level-1 PTE for va if a superpage may go there:
+// it is unused, or points to a page-table page with no valid
+// entries, which is freed. Otherwise return 0. If alloc!=0,
+// create the level-1 page-table page if required.
+static pte_t *superslot(pagetable_t pagetable, uint64 va, int alloc) {
+  pte_t *pte = &pagetable[PX(2, va)];
+  pagetable_t table;
+  int i;
+
+  if ((*pte & PTE_V) == 0) {
+    if (!alloc || (table = (pagetable_t)kalloc_zeroed()) == 0) return 0;
+    *pte = PA2PTE(table) | PTE_V;
+  }
+  if (PTE_LEAF(*pte)) return 0;
+  pte = &((pagetable_t)PTE2PA(*pte))[PX(1, va)];
+  if ((*pte & PTE_V) == 0) return pte;
+  if (PTE_LEAF(*pte)) return 0;
+  table = (pagetable_t)PTE2PA(*pte);
+  for (i = 0; i < 512; i++)
+    if (table[i] & PTE_V) return 0;
+  kfree(table);
+  *pte = 0;
+  return pte;
+}
+
+// Return the level-1 PTE for va if it maps a superpage, else 0.
+static pte_t *superpte(pagetable_t pagetable, uint64 va) {
+  pte_t *pte = &pagetable[PX(2, va)];
+
+  if ((*pte & PTE_V) == 0 || PTE_LEAF(*pte)) return 0;
+  pte = &((pagetable_t)PTE2PA(*pte))[PX(1, va)];
+  return (*pte & PTE_V) && PTE_LEAF(*pte) ? pte : 0;
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -99,11 +177,9 @@ uint64 walkaddr(pagetable_t pagetable, uint64 va) {
 
   if (va >= MAXVA) return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walkleaf(pagetable, va, &pa);
   if (pte == 0) return 0;
-  if ((*pte & PTE_V) == 0) return 0;
   if ((*pte & PTE_U) == 0) return 0;
-  pa = PTE2PA(*pte);
   return pa;
 }
 
@@ -117,6 +193,8 @@ void kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm) {
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa.
 // va and size MUST be page-aligned.
+// Where va and pa are both 2 MB aligned and at least 2 MB
+// remain, map a superpage if nothing is mapped there yet.
 // Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm) {
@@ -132,6 +210,13 @@ int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = va;
   last = va + size - PGSIZE;
   for (;;) {
+    if (a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 && last - a >= SUPERPGSIZE - PGSIZE && (pte = superslot(pagetable, a, 1)) != 0) {
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      if (a == last - (SUPERPGSIZE - PGSIZE)) break;
+      a += SUPERPGSIZE;
+      pa += SUPERPGSIZE;
+      continue;
+    }
     if ((pte = walk(pagetable, a, 1)) == 0) return -1;
     if (*pte & PTE_V) panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
@@ -143,17 +228,36 @@ int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never faulted in (see
+// lazyalloc()) are skipped.
 // Optionally free the physical memory.
 void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free) {
-  uint64 a;
+  uint64 a, end = va + npages * PGSIZE;
   pte_t *pte;
+  pagetable_t table;
 
   if ((va % PGSIZE) != 0) panic("uvmunmap: not aligned");
 
-  for (a = va; a < va + npages * PGSIZE; a += PGSIZE) {
-    if ((pte = walk(pagetable, a, 0)) == 0) panic("uvmunmap: walk");
-    if ((*pte & PTE_V) == 0) panic("uvmunmap: not mapped");
+  for (a = va; a < end; a += PGSIZE) {
+    if ((pte = superpte(pagetable, a)) != 0) {
+      if (a % SUPERPGSIZE == 0 && end - a >= SUPERPGSIZE) {
+        if (do_free) kfree_pages((void *)PTE2PA(*pte), SUPERPGORDER);
+        *pte = 0;
+        a += SUPERPGSIZE - PGSIZE;
+        continue;
+      }
+      // removing part of a superpage: split it. a's page
+      // is to be freed, so it can become the page-table page.
+      if (do_free) {
+        table = (pagetable_t)(PTE2PA(*pte) + (a - SUPERPGROUNDDOWN(a)));
+        splitsuper(pte, table);
+        table[PX(0, a)] = 0;
+        continue;
+      }
+      if (splitsuper(pte, 0) != 0) panic("uvmunmap: split");
+    }
+    if ((pte = walk(pagetable, a, 0)) == 0) continue;
+    if ((*pte & PTE_V) == 0) continue;
     if (PTE_FLAGS(*pte) == PTE_V) panic("uvmunmap: not a leaf");
     if (do_free) {
       uint64 pa = PTE2PA(*pte);
@@ -163,13 +267,27 @@ void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free) {
   }
 }
 
+// Map a zeroed superpage at va, which must be 2 MB aligned,
+// if one is free and nothing is mapped in its range yet.
+// Returns 0 on success, -1 if the caller should map 4 KB
+// pages instead.
+static int mapsuper(pagetable_t pagetable, uint64 va, int perm) {
+  pte_t *pte;
+  char *mem;
+
+  if ((pte = superslot(pagetable, va, 1)) == 0) return -1;
+  if ((mem = kalloc_pages(SUPERPGORDER)) == 0) return -1;
+  memset(mem, 0, SUPERPGSIZE);
+  *pte = PA2PTE(mem) | perm | PTE_V;
+  return 0;
+}
+
 // create an empty user page table.
 // returns 0 if out of memory.
 pagetable_t uvmcreate() {
   pagetable_t pagetable;
-  pagetable = (pagetable_t)kalloc();
+  pagetable = (pagetable_t)kalloc_zeroed();
   if (pagetable == 0) return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -180,8 +298,7 @@ void uvmfirst(pagetable_t pagetable, uchar *src, uint sz) {
   char *mem;
 
   if (sz >= PGSIZE) panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W | PTE_R | PTE_X | PTE_U);
   memmove(mem, src, sz);
 }
@@ -196,12 +313,15 @@ uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm) {
 
   oldsz = PGROUNDUP(oldsz);
   for (a = oldsz; a < newsz; a += PGSIZE) {
-    mem = kalloc();
+    if (a % SUPERPGSIZE == 0 && newsz - a >= SUPERPGSIZE && mapsuper(pagetable, a, PTE_R | PTE_U | xperm) == 0) {
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    mem = kalloc_zeroed();
     if (mem == 0) {
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if (mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R | PTE_U | xperm) != 0) {
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -253,32 +373,42 @@ void uvmfree(pagetable_t pagetable, uint64 sz) {
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies only the page table: the physical
+// pages are shared copy-on-write. Writable
+// pages become read-only PTE_COW pages in both
+// tables, and are copied by cowfault() on the
+// first write.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
-int uvmcopy(pagetable_t old, pagetable_t new, uint64 sz) {
+int uvmcopy(pagetable_t old, pagetable_t new, uint64 sz) { return uvmshare(old, new, 0, sz, 1); }
+
+// Map the pages of old in [va, va+len) at the same
+// addresses in new, sharing the physical memory.
+// If cow, writable pages become copy-on-write in
+// both tables; otherwise they stay writable in both.
+// va must be page-aligned.
+// returns 0 on success, -1 on failure.
+// frees any allocated pages on failure.
+int uvmshare(pagetable_t old, pagetable_t new, uint64 va, uint64 len, int cow) {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for (i = 0; i < sz; i += PGSIZE) {
-    if ((pte = walk(old, i, 0)) == 0) panic("uvmcopy: pte should exist");
-    if ((*pte & PTE_V) == 0) panic("uvmcopy: page not present");
+  for (i = va; i < va + len; i += PGSIZE) {
+    // the pages of a superpage are shared one by one.
+    if ((pte = superpte(old, i)) != 0 && splitsuper(pte, 0) != 0) goto err;
+    if ((pte = walk(old, i, 0)) == 0) continue;
+    if ((*pte & PTE_V) == 0) continue;  // not yet faulted in
+    if (cow && (*pte & PTE_W)) *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if ((mem = kalloc()) == 0) goto err;
-    memmove(mem, (char *)pa, PGSIZE);
-    if (mappages(new, i, PGSIZE, (uint64)mem, flags) != 0) {
-      kfree(mem);
-      goto err;
-    }
+    if (mappages(new, i, PGSIZE, pa, flags) != 0) goto err;
+    kaddref((void *)pa);
   }
   return 0;
 
 err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, va, (i - va) / PGSIZE, 1);
   return -1;
 }
 
@@ -292,6 +422,76 @@ void uvmclear(pagetable_t pagetable, uint64 va) {
   *pte &= ~PTE_U;
 }
 
+// Handle a write to the copy-on-write page at va:
+// give the page table a private, writable copy of it.
+// If no one else refers to the page any more, just
+// make it writable again.
+// Returns 0 on success, -1 if va is not a COW page
+// or there is no memory for the copy.
+int cowfault(pagetable_t pagetable, uint64 va) {
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if (va >= MAXVA) return -1;
+  pte = walk(pagetable, va, 0);
+  if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_COW) == 0) return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if (krefcnt((void *)pa) == 1) {
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+
+  if ((mem = kalloc()) == 0) return -1;
+  memmove(mem, (char *)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void *)pa);
+  return 0;
+}
+
+// Allocate a zeroed page for the user address va, which lies
+// in memory that sbrk() granted but that has not been touched
+// yet. sz is the process size. If super is set, map all of
+// va's 2 MB with a superpage when it lies in the heap; that
+// takes a 2 MB block and zeroes it, so only the page-fault
+// path, which holds no locks, asks for it.
+// Returns 0 on success, -1 if va is not such an address or
+// there is no memory.
+int lazyalloc(pagetable_t pagetable, uint64 va, uint64 sz, int super) {
+  pte_t *pte;
+  char *mem;
+
+  if (va >= sz || va >= MAXVA) return -1;
+  va = PGROUNDDOWN(va);
+  if ((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V)) return -1;  // e.g. the stack guard page
+
+  // all of va's 2 MB lies in the heap: map it in one go.
+  if (super && SUPERPGROUNDDOWN(va) + SUPERPGSIZE <= sz && mapsuper(pagetable, SUPERPGROUNDDOWN(va), PTE_R | PTE_W | PTE_U) == 0) return 0;
+
+  if ((mem = kalloc_zeroed()) == 0) return -1;
+  if (mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R | PTE_W | PTE_U) != 0) {
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Fault in the page at va for copyin()/copyout(), if it is
+// heap of the current process that has not been touched yet.
+// Only a 4 KB page: callers may hold a spinlock, like a pipe's.
+// Pages of mapped files are not read in here, since that
+// sleeps; argaddr(), fetchstr(), read() and write() call
+// vmaprefault() first.
+static int lazycopy(pagetable_t pagetable, uint64 va) {
+  struct proc *p = myproc();
+
+  if (p == 0 || p->pagetable != pagetable) return -1;
+  return lazyalloc(pagetable, va, p->sz, 0);
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -302,12 +502,17 @@ int copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len) {
   while (len > 0) {
     va0 = PGROUNDDOWN(dstva);
     if (va0 >= MAXVA) return -1;
-    pte = walk(pagetable, va0, 0);
-    if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_W) == 0) return -1;
-    pa0 = PTE2PA(*pte);
+    pte = walkleaf(pagetable, va0, &pa0);
+    if (pte == 0 && lazycopy(pagetable, va0) == 0) pte = walkleaf(pagetable, va0, &pa0);
+    if (pte && (*pte & PTE_COW)) {
+      if (cowfault(pagetable, va0) < 0) return -1;
+      pte = walkleaf(pagetable, va0, &pa0);
+    }
+    if (pte == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_W) == 0) return -1;
     n = PGSIZE - (dstva - va0);
     if (n > len) n = len;
     memmove((void *)(pa0 + (dstva - va0)), src, n);
+    *pte |= PTE_D;  // the store went through pa0, so mark it by hand
 
     len -= n;
     src += n;
@@ -325,6 +530,7 @@ int copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len) {
   while (len > 0) {
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
+    if (pa0 == 0 && lazycopy(pagetable, va0) == 0) pa0 = walkaddr(pagetable, va0);
     if (pa0 == 0) return -1;
     n = PGSIZE - (srcva - va0);
     if (n > len) n = len;
@@ -348,6 +554,7 @@ int copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max) {
   while (got_null == 0 && max > 0) {
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
+    if (pa0 == 0 && lazycopy(pagetable, va0) == 0) pa0 = walkaddr(pagetable, va0);
     if (pa0 == 0) return -1;
     n = PGSIZE - (srcva - va0);
     if (n > max) n = max;
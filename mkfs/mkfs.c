@@ -22,11 +22,12 @@
 
 int nbitmap = FSSIZE/BPB + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGSIZE + 1;  // header block + LOGSIZE data blocks
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
+int extents;  // -e: map blocks with extents (FS_EXTENT)
 struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
@@ -77,8 +78,14 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc > 1 && strcmp(argv[1], "-e") == 0){
+    extents = 1;
+    argc--;
+    argv++;
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-e] fs.img files...\n");
     exit(1);
   }
 
@@ -101,6 +108,7 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.features = xint(extents ? FS_EXTENT : 0);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
@@ -251,6 +259,60 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// return the block holding block fbn of an extent inode,
+// growing the last extent or adding one if fbn is new.
+uint
+extent(struct dinode *din, uint fbn)
+{
+  struct extent ext[NEXTENT + NEXTBLK];
+  uint base, i;
+
+  // gather the inline extents and the extent block into ext[].
+  memmove(ext, din->addrs, NEXTENT * sizeof(struct extent));
+  if(xint(din->addrs[NDIRECT+1]))
+    rsect(xint(din->addrs[NDIRECT+1]), (char*)(ext + NEXTENT));
+  else
+    bzero(ext + NEXTENT, NEXTBLK * sizeof(struct extent));
+
+  base = 0;
+  for(i = 0; i < NEXTENT + NEXTBLK && xint(ext[i].len) != 0; i++){
+    if(fbn < base + xint(ext[i].len))
+      return xint(ext[i].start) + fbn - base;
+    base += xint(ext[i].len);
+  }
+  assert(fbn == base);
+
+  // append: grow the last extent if freeblock follows it.
+  if(i > 0 && xint(ext[i-1].start) + xint(ext[i-1].len) == freeblock){
+    ext[i-1].len = xint(xint(ext[i-1].len) + 1);
+  } else {
+    assert(i < NEXTENT + NEXTBLK);
+    if(i >= NEXTENT && xint(din->addrs[NDIRECT+1]) == 0)
+      din->addrs[NDIRECT+1] = xint(freeblock++);
+    ext[i].start = xint(freeblock);
+    ext[i].len = xint(1);
+  }
+
+  memmove(din->addrs, ext, NEXTENT * sizeof(struct extent));
+  if(xint(din->addrs[NDIRECT+1]))
+    wsect(xint(din->addrs[NDIRECT+1]), (char*)(ext + NEXTENT));
+  return freeblock++;
+}
+
+// return entry i of indirect block bn, allocating it if necessary.
+uint
+indirect(uint bn, uint i)
+{
+  uint a[NINDIRECT];
+
+  rsect(bn, (char*)a);
+  if(a[i] == 0){
+    a[i] = xint(freeblock++);
+    wsect(bn, (char*)a);
+  }
+  return xint(a[i]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -258,7 +320,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -267,21 +328,24 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
+    if(extents){
+      x = extent(&din, fbn);
+    } else if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      x = indirect(xint(din.addrs[NDIRECT]), fbn - NDIRECT);
+    } else {
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
       }
-      x = xint(indirect[fbn-NDIRECT]);
+      x = indirect(xint(din.addrs[NDIRECT+1]), (fbn - NDIRECT - NINDIRECT) / NINDIRECT);
+      x = indirect(x, (fbn - NDIRECT - NINDIRECT) % NINDIRECT);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -0,0 +1,135 @@
+// Print kernel statistics.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/kstat.h"
+#include "user/user.h"
+
+void memstat(char *arg) {
+  struct kmemstat st;
+  uint64 nfree;
+  int i;
+
+  if (kmemstat(&st) < 0) {
+    fprintf(2, "kstat: kmemstat failed\n");
+    exit(1);
+  }
+  nfree = st.gfree + st.zfree;
+  printf("cpu\tfree\thit\tmiss\tsteal\n");
+  for (i = 0; i < NCPU; i++) {
+    if (st.cpu[i].nfree == 0 && st.cpu[i].hit == 0 && st.cpu[i].miss == 0) continue;
+    printf("%d\t%lu\t%lu\t%lu\t%lu\n", i, st.cpu[i].nfree, st.cpu[i].hit, st.cpu[i].miss, st.cpu[i].steal);
+    nfree += st.cpu[i].nfree;
+  }
+  printf("buddy allocator %lu pages, %lu pages free\n", st.gfree, nfree);
+  printf("order\tfree\talloc\n");
+  for (i = 0; i <= MAXORDER; i++) printf("%d\t%lu\t%lu\n", i, st.bfree[i], st.balloc[i]);
+  printf("zeroed pool %lu pages, %lu hit, %lu miss\n", st.zfree, st.zhit, st.zmiss);
+}
+
+void readahead(char *arg) {
+  struct rastat st;
+
+  if (rastat(&st) < 0) {
+    fprintf(2, "kstat: rastat failed\n");
+    exit(1);
+  }
+  printf("read-ahead: %lu blocks issued, %lu hit, %lu wasted\n", st.issued, st.hit, st.waste);
+}
+
+void logging(char *arg) {
+  struct logstat st;
+
+  if (logstat(&st) < 0) {
+    fprintf(2, "kstat: logstat failed\n");
+    exit(1);
+  }
+  printf("log: %lu commits, %lu blocks logged, %lu absorbed\n", st.commits, st.logged, st.absorbed);
+  printf("log: %lu checkpoints, %lu blocks installed\n", st.checkpoints, st.installed);
+}
+
+void sched(char *arg) {
+  struct schedstat st;
+  int i;
+
+  if (schedstat(&st) < 0) {
+    fprintf(2, "kstat: schedstat failed\n");
+    exit(1);
+  }
+  printf("cpu\truns\tsteals\tbusy\tidle\tready\n");
+  for (i = 0; i < NCPU; i++) {
+    if (st.cpu[i].runs == 0 && st.cpu[i].busy == 0 && st.cpu[i].idle == 0) continue;
+    printf("%d\t%lu\t%lu\t%lu\t%lu\t%lu\n", i, st.cpu[i].runs, st.cpu[i].steals, st.cpu[i].busy, st.cpu[i].idle, st.cpu[i].nready);
+  }
+}
+
+// run queue latency of process arg, or of all processes.
+void latency(char *arg) {
+  struct schedlat st;
+  int i, pid = arg ? atoi(arg) : 0;
+
+  if (schedlat(pid, &st) < 0) {
+    fprintf(2, "kstat: schedlat %d failed\n", pid);
+    exit(1);
+  }
+  printf("%lu waits, mean %lu us, max %lu us\n", st.n, st.n ? st.total / st.n : 0, st.max);
+  for (i = 0; i < NLATBUCKET; i++) {
+    if (st.hist[i] == 0) continue;
+    if (i == NLATBUCKET - 1)
+      printf(">= %d us\t%lu\n", 1 << i, st.hist[i]);
+    else
+      printf("< %d us\t%lu\n", 2 << i, st.hist[i]);
+  }
+}
+
+// each slab cache's use, and the pages it saves over
+// giving each object a page of its own.
+void slab(char *arg) {
+  struct slabstat st;
+  uint64 objs, pages;
+  int i;
+
+  if (slabstat(&st) < 0) {
+    fprintf(2, "kstat: slabstat failed\n");
+    exit(1);
+  }
+  objs = pages = 0;
+  printf("cache\t\tsize\tinuse\tcached\tslabs\talloc\n");
+  for (i = 0; i < NCACHE && st.cache[i].size; i++) {
+    printf("%s\t%s%lu\t%lu\t%lu\t%lu\t%lu\n", st.cache[i].name, strlen(st.cache[i].name) < 8 ? "\t" : "", st.cache[i].size, st.cache[i].inuse,
+           st.cache[i].cached, st.cache[i].slabs, st.cache[i].alloc);
+    objs += st.cache[i].inuse;
+    pages += st.cache[i].slabs;
+  }
+  printf("%lu objects in %lu pages, %ld pages saved\n", objs, pages, (long)(objs - pages));
+}
+
+struct {
+  char *name;
+  void (*f)(char *);
+} stats[] = {
+    {"mem", memstat},
+    {"ra", readahead},
+    {"log", logging},
+    {"sched", sched},
+    {"lat", latency},
+    {"slab", slab},
+};
+
+int main(int argc, char *argv[]) {
+  int i;
+
+  if (argc != 2 && argc != 3) {
+    fprintf(2, "usage: kstat mem|ra|log|sched|lat [pid]|slab\n");
+    exit(1);
+  }
+  for (i = 0; i < sizeof(stats) / sizeof(stats[0]); i++) {
+    if (strcmp(argv[1], stats[i].name) == 0) {
+      stats[i].f(argv[2]);
+      exit(0);
+    }
+  }
+  fprintf(2, "kstat: unknown statistic %s\n", argv[1]);
+  exit(1);
+}
@@ -1,4 +1,10 @@
 struct stat;
+struct kmemstat;
+struct rastat;
+struct logstat;
+struct schedstat;
+struct schedlat;
+struct slabstat;
 
 // system calls
 int fork(void);
@@ -22,6 +28,23 @@ int getpid(void);
 char *sbrk(int);
 int sleep(int);
 int uptime(void);
+int kmemstat(struct kmemstat *);
+int rastat(struct rastat *);
+int logstat(struct logstat *);
+int fsync(int);
+int sync(void);
+int setpriority(int, int);
+int getpriority(int);
+int schedstat(struct schedstat *);
+int nanosleep(uint64);
+uint64 uptimens(void);
+int setquantum(int, int);
+int getquantum(int);
+int schedlat(int, struct schedlat *);
+int splice(int, int, int);
+int slabstat(struct slabstat *);
+void *mmap(void *, uint64, int, int, int, uint);
+int munmap(void *, uint64);
 
 // ulib.c
 int stat(const char *, struct stat *);
@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/kstat.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -544,7 +545,11 @@ void writetest(char *s) {
   }
 }
 
+// write a file that reaches a little way into the
+// doubly-indirect block, rather than all of MAXFILE,
+// which is 64 MB.
 void writebig(char *s) {
+  enum { NBIG = NDIRECT + NINDIRECT + 16 };
   int i, fd, n;
 
   fd = open("big", O_CREATE | O_RDWR);
@@ -553,7 +558,7 @@ void writebig(char *s) {
     exit(1);
   }
 
-  for (i = 0; i < MAXFILE; i++) {
+  for (i = 0; i < NBIG; i++) {
     ((int *)buf)[0] = i;
     if (write(fd, buf, BSIZE) != BSIZE) {
       printf("%s: error: write big file failed i=%d\n", s, i);
@@ -573,7 +578,7 @@ void writebig(char *s) {
   for (;;) {
     i = read(fd, buf, BSIZE);
     if (i == 0) {
-      if (n != MAXFILE) {
+      if (n != NBIG) {
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -740,6 +745,172 @@ void pipe1(char *s) {
   }
 }
 
+// move 4 MB through a pipe in BUFSZ writes, check it
+// arrives intact, and report the throughput.
+void pipebw(char *s) {
+  enum { TOTAL = 4 * 1024 * 1024 };
+  int fds[2], pid, xstatus;
+  int i, n, total;
+  uint64 t0, t1;
+
+  if (pipe(fds) != 0) {
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    for (total = 0; total < TOTAL; total += BUFSZ) {
+      for (i = 0; i < BUFSZ; i += 512) buf[i] = (total + i) / 512;
+      if (write(fds[1], buf, BUFSZ) != BUFSZ) {
+        printf("%s: write failed\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  close(fds[1]);
+  t0 = uptimens();
+  total = 0;
+  while ((n = read(fds[0], buf, BUFSZ)) > 0) {
+    for (i = (512 - total % 512) % 512; i < n; i += 512) {
+      if (buf[i] != (char)((total + i) / 512)) {
+        printf("%s: wrong data at %d\n", s, total + i);
+        exit(1);
+      }
+    }
+    total += n;
+  }
+  t1 = uptimens();
+  close(fds[0]);
+  wait(&xstatus);
+  if (xstatus != 0) exit(xstatus);
+  if (total < TOTAL) {
+    printf("%s: read %d bytes\n", s, total);
+    exit(1);
+  }
+  printf("%d KB/s ", (int)((uint64)total / 1024 * 1000000 / ((t1 - t0) / 1000 + 1)));
+}
+
+// splice() a file into a pipe and the pipe into another
+// file, and check both copies.
+void splicetest(char *s) {
+  enum { SZ = 3 * 1024 + 100 };
+  int fd, fd2, fds[2], i, n;
+
+  fd = open("splice.in", O_CREATE | O_RDWR);
+  fd2 = open("splice.out", O_CREATE | O_RDWR);
+  if (fd < 0 || fd2 < 0 || pipe(fds) != 0) {
+    printf("%s: open or pipe failed\n", s);
+    exit(1);
+  }
+  for (i = 0; i < SZ; i++) buf[i] = i % 251;
+  if (write(fd, buf, SZ) != SZ) {
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if (splice(fd, fd2, SZ) != -1) {
+    printf("%s: spliced between two files\n", s);
+    exit(1);
+  }
+
+  close(fd);
+  fd = open("splice.in", O_RDONLY);
+  if ((n = splice(fd, fds[1], SZ + 1000)) != SZ) {
+    printf("%s: spliced %d bytes into the pipe\n", s, n);
+    exit(1);
+  }
+  if (splice(fd, fds[1], 10) != 0) {
+    printf("%s: spliced past the end\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  for (i = 0; i < SZ; i += n) {
+    if ((n = splice(fds[0], fd2, SZ)) <= 0) {
+      printf("%s: splice from the pipe failed\n", s);
+      exit(1);
+    }
+  }
+  if (splice(fds[0], fd2, SZ) != 0) {
+    printf("%s: no EOF from the pipe\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fd);
+  close(fd2);
+
+  fd2 = open("splice.out", O_RDONLY);
+  memset(buf, 0, SZ);
+  if (read(fd2, buf, SZ + 1) != SZ) {
+    printf("%s: splice.out has the wrong size\n", s);
+    exit(1);
+  }
+  for (i = 0; i < SZ; i++) {
+    if ((buf[i] & 0xff) != i % 251) {
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd2);
+  unlink("splice.in");
+  unlink("splice.out");
+}
+
+// struct pipes should come from the "pipe" slab cache,
+// many to a page.
+int pipesinuse(struct slabstat *st, uint64 *slabs) {
+  int i;
+
+  if (slabstat(st) != 0) return -1;
+  for (i = 0; i < NCACHE && st->cache[i].size; i++) {
+    if (strcmp(st->cache[i].name, "pipe") == 0) {
+      *slabs = st->cache[i].slabs;
+      return st->cache[i].inuse;
+    }
+  }
+  return -1;
+}
+
+void pipeslab(char *s) {
+  enum { N = 6 };
+  struct slabstat st;
+  int fds[N][2], i, n0, n1;
+  uint64 slabs;
+
+  if ((n0 = pipesinuse(&st, &slabs)) < 0) {
+    printf("%s: no pipe cache\n", s);
+    exit(1);
+  }
+  for (i = 0; i < N; i++) {
+    if (pipe(fds[i]) != 0) {
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+  }
+  n1 = pipesinuse(&st, &slabs);
+  if (n1 != n0 + N || slabs >= n1) {
+    printf("%s: %d pipes in use in %lu slabs, expected %d\n", s, n1, slabs, n0 + N);
+    exit(1);
+  }
+  for (i = 0; i < N; i++) {
+    if (write(fds[i][1], "x", 1) != 1 || read(fds[i][0], buf, 1) != 1 || buf[0] != 'x') {
+      printf("%s: pipe %d broken\n", s, i);
+      exit(1);
+    }
+    close(fds[i][0]);
+    close(fds[i][1]);
+  }
+  if ((n1 = pipesinuse(&st, &slabs)) != n0) {
+    printf("%s: %d pipes in use after close, expected %d\n", s, n1, n0);
+    exit(1);
+  }
+}
+
 // test if child is killed (status = -1)
 void killstatus(char *s) {
   int xst;
@@ -1628,6 +1799,247 @@ void bigwrite(char *s) {
   }
 }
 
+// a sequential read of a file too big to stay in the
+// buffer cache should be served from blocks read ahead.
+void readahead(char *s) {
+  enum { NBLK = 4 * NBUF };
+  struct rastat st0, st1;
+  int fd, i, n;
+
+  fd = open("readahead", O_CREATE | O_WRONLY);
+  if (fd < 0) {
+    printf("%s: create readahead failed\n", s);
+    exit(1);
+  }
+  for (i = 0; i < NBLK; i++) {
+    ((int *)buf)[0] = i;
+    if (write(fd, buf, BSIZE) != BSIZE) {
+      printf("%s: write readahead failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  rastat(&st0);
+  fd = open("readahead", O_RDONLY);
+  for (i = 0; (n = read(fd, buf, 512)) > 0; i++) {
+    if (i % 2 == 0 && ((int *)buf)[0] != i / 2) {
+      printf("%s: block %d has wrong content\n", s, i / 2);
+      exit(1);
+    }
+  }
+  close(fd);
+  rastat(&st1);
+  if (i != 2 * NBLK) {
+    printf("%s: read %d half-blocks, expected %d\n", s, i, 2 * NBLK);
+    exit(1);
+  }
+  if (st1.issued == st0.issued || st1.hit == st0.hit) {
+    printf("%s: no read-ahead hits\n", s);
+    exit(1);
+  }
+  unlink("readahead");
+}
+
+// directory churn rewrites the same bitmap, inode and
+// directory blocks over and over; the log should absorb
+// most of those writes instead of installing each one.
+void logabsorb(char *s) {
+  struct logstat st0, st1;
+  char name[3];
+  int i;
+
+  logstat(&st0);
+  for (i = 0; i < 100; i++) {
+    name[0] = 'a';
+    name[1] = '0' + i % 10;
+    name[2] = 0;
+    if (mkdir(name) != 0) {
+      printf("%s: mkdir %s failed\n", s, name);
+      exit(1);
+    }
+    if (unlink(name) != 0) {
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+    sync();  // one transaction per iteration
+  }
+  logstat(&st1);
+  if (st1.absorbed == st0.absorbed) {
+    printf("%s: no log writes absorbed\n", s);
+    exit(1);
+  }
+  if (st1.installed - st0.installed >= st1.logged - st0.logged) {
+    printf("%s: installed %lu blocks for %lu logged\n", s, st1.installed - st0.installed, st1.logged - st0.logged);
+    exit(1);
+  }
+}
+
+// end_op() may leave a transaction open in memory;
+// fsync() and sync() must commit it before returning.
+void fsynctest(char *s) {
+  struct logstat st0, st1;
+  int fd, p[2];
+
+  fd = open("fsyncfile", O_CREATE | O_WRONLY);
+  if (fd < 0) {
+    printf("%s: create fsyncfile failed\n", s);
+    exit(1);
+  }
+  logstat(&st0);
+  if (write(fd, "x", 1) != 1) {
+    printf("%s: write fsyncfile failed\n", s);
+    exit(1);
+  }
+  if (fsync(fd) != 0) {
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  logstat(&st1);
+  if (st1.commits == st0.commits) {
+    printf("%s: fsync did not commit\n", s);
+    exit(1);
+  }
+  close(fd);
+  if (unlink("fsyncfile") != 0) {
+    printf("%s: unlink fsyncfile failed\n", s);
+    exit(1);
+  }
+  if (sync() != 0) {
+    printf("%s: sync failed\n", s);
+    exit(1);
+  }
+  logstat(&st0);
+  if (st0.commits == st1.commits) {
+    printf("%s: sync did not commit\n", s);
+    exit(1);
+  }
+
+  if (fsync(fd) != -1) {
+    printf("%s: fsync of a closed fd succeeded\n", s);
+    exit(1);
+  }
+  if (pipe(p) != 0) {
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if (fsync(p[0]) != -1) {
+    printf("%s: fsync of a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  close(p[1]);
+}
+
+// setpriority()/getpriority() on self, on a spinning
+// child, and with bad arguments.
+void priotest(char *s) {
+  int pid, prio;
+
+  if (setpriority(getpid(), NPRIO - 1) != 0) {
+    printf("%s: setpriority failed\n", s);
+    exit(1);
+  }
+  // a priority boost may have moved us up since.
+  prio = getpriority(getpid());
+  if (prio < 0 || prio >= NPRIO) {
+    printf("%s: getpriority returned %d\n", s, prio);
+    exit(1);
+  }
+  setpriority(getpid(), 0);
+
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    for (;;);
+  }
+  if (setpriority(pid, 1) != 0 || getpriority(pid) < 0) {
+    printf("%s: setpriority of child failed\n", s);
+    exit(1);
+  }
+  kill(pid);
+  wait(0);
+
+  if (setpriority(getpid(), NPRIO) != -1 || setpriority(getpid(), -1) != -1) {
+    printf("%s: setpriority accepted a bad level\n", s);
+    exit(1);
+  }
+  if (getpriority(pid) != -1 || setpriority(pid, 0) != -1) {
+    printf("%s: priority of a dead process\n", s);
+    exit(1);
+  }
+}
+
+// nanosleep() must sleep at least as long as asked, and
+// need not round up to a whole clock tick.
+void nanosleeptest(char *s) {
+  uint64 t0, t1;
+  int i;
+
+  for (i = 0; i < 5; i++) {
+    t0 = uptimens();
+    if (nanosleep(5000000) != 0) {  // 5 ms, well under a tick
+      printf("%s: nanosleep failed\n", s);
+      exit(1);
+    }
+    t1 = uptimens();
+    if (t1 - t0 < 5000000) {
+      printf("%s: woke after %lu ns\n", s, t1 - t0);
+      exit(1);
+    }
+    if (t1 - t0 < 50000000) return;
+  }
+  printf("%s: 5 ms sleeps took %lu ns\n", s, t1 - t0);
+  exit(1);
+}
+
+// setquantum() takes lengths in range, and a fork child
+// inherits its parent's. schedlat() counts each time a
+// process is scheduled.
+void quantumtest(char *s) {
+  struct schedlat st;
+  int pid, xstatus;
+
+  if (setquantum(getpid(), MINQUANTUM - 1) != -1 || setquantum(getpid(), MAXQUANTUM + 1) != -1) {
+    printf("%s: setquantum accepted a bad length\n", s);
+    exit(1);
+  }
+  if (setquantum(getpid(), 10000) != 0 || getquantum(getpid()) != 10000) {
+    printf("%s: setquantum failed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    if (getquantum(getpid()) != 10000) exit(1);
+    if (schedlat(getpid(), &st) != 0 || st.n < 1) exit(1);
+    nanosleep(1000000);
+    if (schedlat(getpid(), &st) != 0 || st.n < 2) exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if (xstatus != 0) {
+    printf("%s: child quantum or latency wrong\n", s);
+    exit(1);
+  }
+  if (schedlat(pid, &st) != -1 || getquantum(pid) != -1) {
+    printf("%s: quantum of a dead process\n", s);
+    exit(1);
+  }
+  if (schedlat(0, &st) != 0 || st.n < 2) {
+    printf("%s: no system-wide latency\n", s);
+    exit(1);
+  }
+  setquantum(getpid(), TICKCYCLES / (TIMEBASE / 1000000));
+}
+
 void bigfile(char *s) {
   enum { N = 20, SZ = 600 };
   int fd, i, total, cc;
@@ -1879,6 +2291,51 @@ void forktest(char *s) {
   }
 }
 
+// fork a process that holds more than half of physical
+// memory; only possible if fork() shares pages copy-on-write.
+// then check that writes on either side stay private.
+void cowfork(char *s) {
+  uint64 phys_size = PHYSTOP - KERNBASE;
+  int sz = (phys_size / 3) * 2;
+  int pid, ppid, xstatus;
+  char *p = sbrk(sz);
+
+  if (p == (char *)0xffffffffffffffffL) {
+    printf("%s: sbrk(%d) failed\n", s, sz);
+    exit(1);
+  }
+  ppid = getpid();
+  for (char *q = p; q < p + sz; q += 4096) *(int *)q = ppid;
+
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    for (char *q = p; q < p + sz; q += 4096 * 64) {
+      if (*(int *)q != ppid) {
+        printf("%s: child sees wrong data\n", s);
+        exit(1);
+      }
+      *(int *)q = getpid();
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if (xstatus != 0) exit(1);
+  for (char *q = p; q < p + sz; q += 4096) {
+    if (*(int *)q != ppid) {
+      printf("%s: parent sees child's write\n", s);
+      exit(1);
+    }
+  }
+  if (sbrk(-sz) == (char *)0xffffffffffffffffL) {
+    printf("%s: sbrk(-%d) failed\n", s, sz);
+    exit(1);
+  }
+}
+
 void sbrkbasic(char *s) {
   enum { TOOMUCH = 1024 * 1024 * 1024 };
   int i, pid, xstatus;
@@ -1940,6 +2397,275 @@ void sbrkbasic(char *s) {
   exit(xstatus);
 }
 
+// mmap() a file: MAP_SHARED writes reach the file when
+// unmapped, MAP_PRIVATE writes do not, and a forked child
+// sees the parent's mapping.
+void mmaptest(char *s) {
+  enum { N = 2 * 4096 + 100 };
+  char *p;
+  int fd, i, pid, xstatus;
+
+  fd = open("mmapfile", O_CREATE | O_RDWR);
+  if (fd < 0) {
+    printf("%s: create mmapfile failed\n", s);
+    exit(1);
+  }
+  for (i = 0; i < N; i++) {
+    char c = 'a' + i % 26;
+    if (write(fd, &c, 1) != 1) {
+      printf("%s: write mmapfile failed\n", s);
+      exit(1);
+    }
+  }
+
+  // private: readable, writable, but not written back.
+  p = mmap(0, N, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (p == (char *)-1) {
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  for (i = 0; i < N; i++) {
+    if (p[i] != 'a' + i % 26) {
+      printf("%s: mapped byte %d is %x\n", s, i, p[i]);
+      exit(1);
+    }
+  }
+  if (p[N] != 0) {
+    printf("%s: bytes past end of file not zero\n", s);
+    exit(1);
+  }
+  p[0] = 'Z';
+  if (munmap(p, N) < 0) {
+    printf("%s: munmap private failed\n", s);
+    exit(1);
+  }
+
+  // shared: writes reach the file, also from a child.
+  p = mmap(0, N, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == (char *)-1) {
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  if (p[0] != 'a') {
+    printf("%s: private write reached the file\n", s);
+    exit(1);
+  }
+  p[1] = 'Y';
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    if (p[1] != 'Y') exit(1);
+    p[N - 1] = 'X';
+    exit(0);
+  }
+  wait(&xstatus);
+  if (xstatus != 0) {
+    printf("%s: child did not see the mapping\n", s);
+    exit(1);
+  }
+  if (munmap(p, 4096) < 0 || munmap(p + 4096, N - 4096) < 0) {
+    printf("%s: munmap shared failed\n", s);
+    exit(1);
+  }
+  if (munmap(p, 4096) == 0) {
+    printf("%s: munmap of unmapped page succeeded\n", s);
+    exit(1);
+  }
+
+  if (read(fd, buf, 1) != 0) {
+    printf("%s: mapping extended the file\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("mmapfile", O_RDONLY);
+  if (read(fd, buf, N) != N || buf[0] != 'a' || buf[1] != 'Y' || buf[N - 1] != 'X') {
+    printf("%s: shared write did not reach the file\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapfile");
+}
+
+// system calls other than read() and write() should fault in
+// untouched pages of a mapping they are given: a path name
+// for open(), a struct stat for fstat().
+void mmapargs(char *s) {
+  char *p;
+  struct stat *st;
+  int fd, fd2;
+
+  fd = open("mmappath", O_CREATE | O_RDWR);
+  if (fd < 0 || write(fd, "mmappath", 9) != 9) {
+    printf("%s: create mmappath failed\n", s);
+    exit(1);
+  }
+  p = mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (p == (char *)-1) {
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if ((fd2 = open(p, O_RDONLY)) < 0) {
+    printf("%s: open of a path in an untouched mapping failed\n", s);
+    exit(1);
+  }
+  close(fd2);
+  munmap(p, 4096);
+
+  p = mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  st = (struct stat *)(p + 16);
+  if (p == (char *)-1 || fstat(fd, st) < 0 || st->size != 9) {
+    printf("%s: fstat into an untouched mapping failed\n", s);
+    exit(1);
+  }
+  munmap(p, 4096);
+  close(fd);
+  unlink("mmappath");
+}
+
+// Time strided reads of n bytes at a, one per page.
+uint64 strided(char *a, uint64 n) {
+  volatile char sum = 0;
+  uint64 t0, off;
+  int rep;
+
+  t0 = uptimens();
+  for (rep = 0; rep < 50; rep++)
+    for (off = 0; off < n; off += PGSIZE) sum += a[off];
+  return uptimens() - t0;
+}
+
+// Large aligned heap regions should be mapped with 2 MB
+// superpages, which fork() and a partial sbrk() shrink split.
+// Also report how much faster strided reads are through
+// superpages than through 4 KB pages.
+void superpage(char *s) {
+  enum { N = 4, SZ = N * SUPERPGSIZE };
+  struct kmemstat st0, st1;
+  char *base, *a, *b;
+  uint64 off, t4k, t2m, nsuper, used;
+  int i, pid, xstatus;
+
+  base = sbrk(0);
+  sbrk((SUPERPGSIZE - (uint64)base % SUPERPGSIZE) % SUPERPGSIZE);
+
+  // touch the first page of each 2 MB of a before the rest
+  // of it exists, so that a gets 4 KB pages.
+  a = sbrk(0);
+  for (i = 0; i < N; i++) {
+    if (sbrk(PGSIZE) == (char *)-1) {
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    a[i * SUPERPGSIZE] = 1;
+    sbrk(SUPERPGSIZE - PGSIZE);
+  }
+  if ((b = sbrk(SZ)) == (char *)-1) {
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  kmemstat(&st0);
+  for (off = 0; off < SZ; off += PGSIZE) {
+    a[off] = off / PGSIZE;
+    b[off] = off / PGSIZE;
+  }
+  kmemstat(&st1);
+  // free memory in blocks of a superpage or larger.
+  for (nsuper = 0, i = SUPERPGORDER; i <= MAXORDER; i++) nsuper += st0.bfree[i] << (i - SUPERPGORDER);
+  used = st1.balloc[SUPERPGORDER] - st0.balloc[SUPERPGORDER];
+  if (nsuper >= N && used != N) {
+    printf("%s: %lu superpages used, not %d\n", s, used, N);
+    exit(1);
+  }
+
+  t4k = strided(a, SZ);
+  t2m = strided(b, SZ);
+  printf("4K pages %lu us, 2M pages %lu us ", t4k / 1000, t2m / 1000);
+
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    for (off = 0; off < SZ; off += PGSIZE) {
+      if (b[off] != (char)(off / PGSIZE)) exit(1);
+      b[off] = 0;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if (xstatus != 0) {
+    printf("%s: child saw wrong data\n", s);
+    exit(1);
+  }
+
+  // drop the top three pages of the last superpage.
+  sbrk(-3 * PGSIZE);
+  for (off = 0; off < SZ - 3 * PGSIZE; off += PGSIZE) {
+    if (b[off] != (char)(off / PGSIZE)) {
+      printf("%s: wrong data at %lu\n", s, off);
+      exit(1);
+    }
+  }
+  sbrk(-(sbrk(0) - base));
+}
+
+// sbrk() should only reserve address space; pages are
+// allocated, zeroed, when first touched by the program
+// or by a system call.
+void sbrklazy(char *s) {
+  enum { HUGE = 1024 * 1024 * 1024 };
+  char *a, *p;
+  int fd;
+
+  a = sbrk(HUGE);
+  if (a == (char *)0xffffffffffffffffL) {
+    printf("%s: sbrk(%d) failed\n", s, HUGE);
+    exit(1);
+  }
+
+  // touch a few scattered pages.
+  for (p = a; p < a + HUGE; p += HUGE / 8) {
+    if (*p != 0) {
+      printf("%s: lazily allocated page not zero\n", s);
+      exit(1);
+    }
+    *p = 1;
+  }
+
+  // let the kernel fault pages in on our behalf.
+  p = a + HUGE - 4096;
+  fd = open("README", O_RDONLY);
+  if (fd < 0) {
+    printf("%s: open README failed\n", s);
+    exit(1);
+  }
+  if (read(fd, p, 10) != 10) {
+    printf("%s: read into untouched page failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("sbrklazy", O_CREATE | O_WRONLY);
+  if (fd < 0) {
+    printf("%s: create sbrklazy failed\n", s);
+    exit(1);
+  }
+  if (write(fd, a + HUGE / 2 + 4096, 10) != 10) {
+    printf("%s: write from untouched page failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("sbrklazy");
+
+  if (sbrk(-HUGE) == (char *)0xffffffffffffffffL) {
+    printf("%s: sbrk(-%d) failed\n", s, HUGE);
+    exit(1);
+  }
+}
+
 void sbrkmuch(char *s) {
   enum { BIG = 100 * 1024 * 1024 };
   char *c, *oldbrk, *a, *lastaddr, *p;
@@ -2441,6 +3167,9 @@ struct test {
     {dirtest, "dirtest"},
     {exectest, "exectest"},
     {pipe1, "pipe1"},
+    {pipebw, "pipebw"},
+    {splicetest, "splicetest"},
+    {pipeslab, "pipeslab"},
     {killstatus, "killstatus"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
@@ -2460,13 +3189,24 @@ struct test {
     {subdir, "subdir"},
     {bigwrite, "bigwrite"},
     {bigfile, "bigfile"},
+    {readahead, "readahead"},
+    {logabsorb, "logabsorb"},
+    {fsynctest, "fsynctest"},
+    {priotest, "priotest"},
+    {nanosleeptest, "nanosleeptest"},
+    {quantumtest, "quantumtest"},
     {fourteen, "fourteen"},
     {rmdot, "rmdot"},
     {dirfile, "dirfile"},
     {iref, "iref"},
     {forktest, "forktest"},
+    {cowfork, "cowfork"},
     {sbrkbasic, "sbrkbasic"},
     {sbrkmuch, "sbrkmuch"},
+    {sbrklazy, "sbrklazy"},
+    {superpage, "superpage"},
+    {mmaptest, "mmaptest"},
+    {mmapargs, "mmapargs"},
     {kernmem, "kernmem"},
     {MAXVAplus, "MAXVAplus"},
     {sbrkfail, "sbrkfail"},
@@ -2670,9 +3410,11 @@ void diskfull(char *s) {
       done = 1;
       break;
     }
-    for (int i = 0; i < MAXFILE; i++) {
-      char buf[BSIZE];
-      if (write(fd, buf, BSIZE) != BSIZE) {
+    // files as large as MAXFILE are needed to fill an
+    // FSSIZE disk; write them BUFSZ at a time.
+    for (int i = 0, n; i < MAXFILE; i += n / BSIZE) {
+      n = MAXFILE - i < BUFSZ / BSIZE ? (MAXFILE - i) * BSIZE : BUFSZ;
+      if (write(fd, buf, n) != n) {
         done = 1;
         close(fd);
         break;
@@ -2754,6 +3496,57 @@ void outofinodes(char *s) {
   }
 }
 
+// write and read back a file of many megabytes, which
+// needs the doubly-indirect block, and report how long
+// each direction took.
+void bigseq(char *s) {
+  enum { NBLK = 16 * 1024 };  // 16 MB
+  int fd, i, j, n, t0, t1, t2;
+
+  unlink("bigseq");
+  fd = open("bigseq", O_CREATE | O_WRONLY);
+  if (fd < 0) {
+    printf("%s: create bigseq failed\n", s);
+    exit(1);
+  }
+  t0 = uptime();
+  for (i = 0; i < NBLK; i += BUFSZ / BSIZE) {
+    for (j = 0; j < BUFSZ / BSIZE; j++) ((int *)(buf + j * BSIZE))[0] = i + j;
+    if (write(fd, buf, BUFSZ) != BUFSZ) {
+      printf("%s: write bigseq failed at block %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  t1 = uptime();
+  fd = open("bigseq", O_RDONLY);
+  if (fd < 0) {
+    printf("%s: open bigseq failed\n", s);
+    exit(1);
+  }
+  for (i = 0; (n = read(fd, buf, BUFSZ)) > 0; i += n / BSIZE) {
+    for (j = 0; j < n / BSIZE; j++) {
+      if (((int *)(buf + j * BSIZE))[0] != i + j) {
+        printf("%s: block %d has wrong content\n", s, i + j);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  t2 = uptime();
+  if (n < 0 || i < NBLK) {
+    printf("%s: read back only %d blocks\n", s, i);
+    exit(1);
+  }
+  printf("%s: %d KB written in %d ticks, read in %d ticks\n", s, NBLK, t1 - t0, t2 - t1);
+
+  if (unlink("bigseq") < 0) {
+    printf("%s: unlink bigseq failed\n", s);
+    exit(1);
+  }
+}
+
 struct test slowtests[] = {
     {bigdir, "bigdir"},
     {manywrites, "manywrites"},
@@ -2761,6 +3554,7 @@ struct test slowtests[] = {
     {execout, "execout"},
     {diskfull, "diskfull"},
     {outofinodes, "outofinodes"},
+    {bigseq, "bigseq"},
 
     {0, 0},
 };
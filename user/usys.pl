@@ -36,3 +36,20 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("kmemstat");
+entry("mmap");
+entry("munmap");
+entry("rastat");
+entry("logstat");
+entry("fsync");
+entry("sync");
+entry("setpriority");
+entry("getpriority");
+entry("schedstat");
+entry("nanosleep");
+entry("uptimens");
+entry("setquantum");
+entry("getquantum");
+entry("schedlat");
+entry("splice");
+entry("slabstat");